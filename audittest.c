@@ -0,0 +1,160 @@
+/* cc audittest.c -o audittest -lX11 -lXtst
+ *
+ * Drives a running dwm through manage, key presses, focus changes,
+ * restacks and unmanage, for the audited build (dwm-audit) that aborts
+ * when a handler goes over its round trip budget. Last, a client with a
+ * minimum size past the 16 bit limit makes a resize of dwm fail with
+ * BadValue, which dwm has to survive. Exits 1 when dwm is not found, does
+ * not follow the pointer or is gone. Run by check.sh, which passes the
+ * ipc socket as argument; it is not used. */
+
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <unistd.h>
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+#include <X11/Xutil.h>
+#include <X11/keysym.h>
+#include <X11/extensions/XTest.h>
+
+#define NWINS 3
+
+static Display *dpy;
+static Window root;
+static int xerrors;
+
+static int
+xerror(Display *d, XErrorEvent *ee)
+{
+	xerrors++;
+	return 0;
+}
+
+/* returns 0 once the _NET_SUPPORTING_WM_CHECK window of dwm is gone */
+static int
+alive(Window check)
+{
+	XWindowAttributes wa;
+
+	xerrors = 0;
+	XGetWindowAttributes(dpy, check, &wa);
+	XSync(dpy, False);
+	return !xerrors;
+}
+
+static Window
+getwin(Window w, const char *name)
+{
+	Atom type;
+	int format;
+	unsigned long n, extra;
+	unsigned char *p = NULL;
+	Window r = None;
+
+	if (XGetWindowProperty(dpy, w, XInternAtom(dpy, name, False), 0, 1, False,
+		XA_WINDOW, &type, &format, &n, &extra, &p) == Success && n == 1)
+		r = *(Window *)p;
+	if (p)
+		XFree(p);
+	return r;
+}
+
+static void
+key(KeySym mod, KeySym sym)
+{
+	KeyCode m = XKeysymToKeycode(dpy, mod), k = XKeysymToKeycode(dpy, sym);
+
+	XTestFakeKeyEvent(dpy, m, True, 0);
+	XTestFakeKeyEvent(dpy, k, True, 0);
+	XTestFakeKeyEvent(dpy, k, False, 0);
+	XTestFakeKeyEvent(dpy, m, False, 0);
+	XSync(dpy, False);
+	usleep(100000);
+}
+
+static void
+settle(void)
+{
+	XSync(dpy, False);
+	usleep(200000);
+}
+
+int
+main(void)
+{
+	Window w[NWINS], check, big;
+	XWindowAttributes wa;
+	XSizeHints hints;
+	int i, ev, err, maj, min;
+
+	if (!(dpy = XOpenDisplay(NULL))) {
+		fputs("audittest: cannot open display\n", stderr);
+		return 1;
+	}
+	root = DefaultRootWindow(dpy);
+	if (!XTestQueryExtension(dpy, &ev, &err, &maj, &min)) {
+		fputs("audittest: no XTEST extension\n", stderr);
+		return 1;
+	}
+	for (i = 0; i < 50 && !(check = getwin(root, "_NET_SUPPORTING_WM_CHECK")); i++)
+		usleep(100000);
+	if (i == 50) {
+		fputs("audittest: no window manager\n", stderr);
+		return 1;
+	}
+	XSetErrorHandler(xerror);
+
+	/* maprequest and manage */
+	for (i = 0; i < NWINS; i++) {
+		w[i] = XCreateSimpleWindow(dpy, root, 0, 0, 200, 200, 0, 0, 0);
+		XStoreName(dpy, w[i], "audittest");
+		XMapWindow(dpy, w[i]);
+		settle();
+	}
+
+	/* focus follows the pointer: enternotify, focus and restack */
+	for (i = 0; i < NWINS; i++) {
+		XGetWindowAttributes(dpy, w[i], &wa);
+		if (wa.map_state != IsViewable)
+			continue;
+		XWarpPointer(dpy, None, w[i], 0, 0, 0, 0, wa.width / 2, wa.height / 2);
+		settle();
+		if (getwin(root, "_NET_ACTIVE_WINDOW") != w[i]) {
+			fprintf(stderr, "audittest: window %d not focused\n", i);
+			return 1;
+		}
+	}
+
+	/* keypress: group_select both ways, togglefloating, setlayout */
+	key(XK_Super_L, XK_y);
+	key(XK_Super_L, XK_o);
+	key(XK_Super_L, XK_space);
+	key(XK_Super_L, XK_space);
+	key(XK_Super_L, XK_bracketleft);
+	key(XK_Super_L, XK_apostrophe);
+
+	/* unmanage */
+	for (i = 0; i < NWINS; i++) {
+		XDestroyWindow(dpy, w[i]);
+		settle();
+	}
+
+	/* fixed, so floating and resized to its hints: 65536 wraps to a
+	 * width of 0 on the wire and the configure fails with BadValue */
+	big = XCreateSimpleWindow(dpy, root, 0, 0, 200, 200, 0, 0, 0);
+	hints.flags = PMinSize | PMaxSize;
+	hints.min_width = hints.max_width = 65536;
+	hints.min_height = hints.max_height = 65536;
+	XSetWMNormalHints(dpy, big, &hints);
+	XMapWindow(dpy, big);
+	settle();
+	settle();
+	if (!alive(check)) {
+		fputs("audittest: dwm exited on a BadValue\n", stderr);
+		return 1;
+	}
+	XDestroyWindow(dpy, big);
+	XCloseDisplay(dpy);
+	return 0;
+}
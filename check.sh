@@ -0,0 +1,60 @@
+#!/bin/sh
+# Runs dwm on a virtual X server and the standalone tests against it.
+# Needs Xvfb, or Xephyr inside a running X session. See "make check".
+
+d=:${CHECK_DISPLAY:-97}
+dwm=${DWM:-./dwm}
+dwmaudit=${DWM_AUDIT:-./dwm-audit}
+fail=0
+
+if command -v Xvfb >/dev/null 2>&1; then
+	Xvfb $d -screen 0 1280x800x24 -nolisten tcp 2>/dev/null &
+elif command -v Xephyr >/dev/null 2>&1; then
+	Xephyr $d -screen 1280x800 -nolisten tcp 2>/dev/null &
+else
+	echo "check: Xvfb or Xephyr is needed" >&2
+	exit 1
+fi
+xpid=$!
+XDG_RUNTIME_DIR=$(mktemp -d) || exit 1
+export DISPLAY=$d XDG_RUNTIME_DIR
+trap 'kill $dpid $xpid 2>/dev/null; rm -rf "$XDG_RUNTIME_DIR"' EXIT
+sleep 1
+
+# check wm test...: starts wm, runs the test with the ipc socket as
+# argument and fails when either the test fails or wm did not survive it
+check() {
+	wm=$1
+	shift
+	log=$XDG_RUNTIME_DIR/$(basename "$wm").log
+	sock=$XDG_RUNTIME_DIR/dwm-$d.sock
+	rm -f "$sock"
+	$wm 2>"$log" &
+	dpid=$!
+	for i in 1 2 3 4 5 6 7 8 9 10; do
+		[ -S "$sock" ] && break
+		sleep 1
+	done
+
+	ok=1
+	"$@" "$sock" || ok=0
+	if ! kill -0 $dpid 2>/dev/null; then
+		echo "check: $wm exited" >&2
+		ok=0
+	fi
+	kill $dpid 2>/dev/null
+	wait $dpid 2>/dev/null
+	# the audit table is printed on exit, an exceeded budget before that
+	if grep -q 'round trips, budget' "$log"; then
+		echo "check: $wm went over a round trip budget" >&2
+		ok=0
+	fi
+	if [ $ok = 0 ]; then
+		cat "$log" >&2
+		fail=1
+	fi
+}
+
+check "$dwm" ./ipctest
+check "$dwmaudit" ./audittest
+exit $fail
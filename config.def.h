@@ -2,6 +2,16 @@
 
 /* constants */
 #define EXIT_RELOAD       1
+#define RELOAD_STATE      "dwm-%s.state" /* in $XDG_RUNTIME_DIR or /tmp, %s is the display */
+#define IPC_SOCKET        "dwm-%s.sock"  /* same place, see ipc.h */
+#define IPC_CLIENTS_MAX   8
+#define IPC_QUEUE         64    /* events queued per subscriber, power of two */
+#define SHM_STATE         "dwm-%s.shm"   /* exported state, see ipc.h */
+#define STATUS_FIFO       "dwm-%s.status" /* status text, one per line */
+#define STATUS_MAX        4096  /* longest status line */
+#define METRICS_FILE      "dwm-%s.prom"  /* Prometheus text, written on SIGUSR1 */
+#define TRACE_FILE        "dwm-%s.trace.json" /* built with -DTRACE, see config.mk */
+#define TRACE_EVENTS      32768 /* calls kept by the flight recorder, power of two */
 #define RESIZEHINTS       0     /* 1 means respect size hints in tiled resizals */
 #define LOCKFULLSCREEN    1     /* 1 will force focus on the fullscreen window */
 #define REFRESH_RATE      120    /* refresh rate (per second) for client move/resize */
@@ -15,7 +25,6 @@
 #define BAR_CLIENT_WIDTH  150
 #define BAR_URGENT_MAX    3
 #define BAR_URGENT_WIDTH  100
-#define BAR_STATUS_LENGTH 100
 #define BAR_STATUS_WIDTH  100
 
 /* appearance */
@@ -50,6 +59,16 @@ static const char *colors[][3]      = {
 	[SchemeMfact]    = { col_yellow,   col_black2,   col_bdr0 },
 };
 
+/* status modules, sampled in dwm and shown after the status text */
+static const StatusModule smodules[] = {
+	/* function         argument                          interval (s) */
+	{ status_cpu,       NULL,                             2 },
+	{ status_mem,       NULL,                             5 },
+	{ status_load,      NULL,                             5 },
+	{ status_battery,   "/sys/class/power_supply/BAT0",   30 },
+	{ status_clock,     "%a %d %b %H:%M",                 1 },
+};
+
 static const Rule rules[] = {
 	/* xprop(1):
 	 *	WM_CLASS(STRING) = instance, class
@@ -206,6 +225,73 @@ static const Key keys[] = {
 	CLIENTKEYS(                      XK_m,      7)
 };
 
+/* IPC commands, the opcode of a command is its index, see ipc.h */
+static const IpcCommand ipccmds[] = {
+	/* function              argument */
+	{ tag_view,              IpcArgTag },
+	{ tag_set,               IpcArgTag },
+	{ tag_toggle_c,          IpcArgTag },
+	{ tag_toggle_m,          IpcArgTag },
+	{ tag_adjacent,          IpcArgInt },
+	{ tag_remove,            IpcArgInt },
+	{ class_select,          IpcArgInt },
+	{ class_adjacent,        IpcArgInt },
+	{ class_stack,           IpcArgInt },
+	{ class_swap,            IpcArgInt },
+	{ client_select,         IpcArgInt },
+	{ client_stack,          IpcArgInt },
+	{ client_swap,           IpcArgInt },
+	{ client_select_urg,     IpcArgNone },
+	{ client_remove_tags,    IpcArgNone },
+	{ group_select,          IpcArgInt },
+	{ group_stack,           IpcArgInt },
+	{ group_adjacent,        IpcArgInt },
+	{ group_swap,            IpcArgInt },
+	{ group_insert,          IpcArgShorts },
+	{ group_append,          IpcArgShorts },
+	{ focusstack,            IpcArgInt },
+	{ focusmon,              IpcArgInt },
+	{ tagmon,                IpcArgInt },
+	{ setlayout,             IpcArgInt },
+	{ setmfact,              IpcArgFloat },
+	{ incnmaster,            IpcArgInt },
+	{ togglefloating,        IpcArgNone },
+	{ togglebar,             IpcArgNone },
+	{ zoom,                  IpcArgNone },
+	{ killclient,            IpcArgNone },
+	{ clear_status_text,     IpcArgNone },
+	{ reload,                IpcArgNone },
+	{ quit,                  IpcArgNone },
+	{ tracedump,             IpcArgNone },
+	{ metricsdump,           IpcArgNone },
+};
+
+/* X round trips allowed per call, checked in builds with -DAUDIT */
+#ifndef AUDIT_ABORT
+#define AUDIT_ABORT 0 /* 1 means abort() on an exceeded budget, for test runs */
+#endif
+static const int rtbudget[MetLast] = {
+	[MetArrange]                  = 0,
+	[MetRestack]                  = 0,
+	[MetDrawbar]                  = 0,
+	[MetManage]                   = 2,
+	[MetUnmanage]                 = 1,
+	[MetEvent + ButtonPress]      = 2,
+	[MetEvent + ClientMessage]    = 2,
+	[MetEvent + ConfigureRequest] = 0,
+	[MetEvent + ConfigureNotify]  = 2,
+	[MetEvent + DestroyNotify]    = 2,
+	[MetEvent + EnterNotify]      = 1,
+	[MetEvent + Expose]           = 0,
+	[MetEvent + FocusIn]          = 0,
+	[MetEvent + KeyPress]         = 2,
+	[MetEvent + MappingNotify]    = 1,
+	[MetEvent + MapRequest]       = 3,
+	[MetEvent + MotionNotify]     = 1,
+	[MetEvent + PropertyNotify]   = 2,
+	[MetEvent + UnmapNotify]      = 2,
+};
+
 /* button definitions */
 /* click can be ClkTagBar, ClkLtSymbol, ClkStatusText, ClkWinTitle, ClkClientWin, or ClkRootWin */
 static const Button buttons[] = {
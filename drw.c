@@ -9,6 +9,7 @@
 #include "util.h"
 
 #define UTF_INVALID 0xFFFD
+#define GLYPH_CACHE 1024 /* power of two */
 
 static int
 utf8decode(const char *s_in, long *u, int *err)
@@ -47,16 +48,13 @@ utf8decode(const char *s_in, long *u, int *err)
 }
 
 Drw *
-drw_create(Display *dpy, int screen, Window root, unsigned int w, unsigned int h)
+drw_create(Display *dpy, int screen, Window root)
 {
 	Drw *drw = ecalloc(1, sizeof(Drw));
 
 	drw->dpy = dpy;
 	drw->screen = screen;
 	drw->root = root;
-	drw->w = w;
-	drw->h = h;
-	drw->drawable = XCreatePixmap(dpy, root, w, h, DefaultDepth(dpy, screen));
 	drw->gc = XCreateGC(dpy, root, 0, NULL);
 	XSetLineAttributes(dpy, drw->gc, 1, LineSolid, CapButt, JoinMiter);
 
@@ -64,25 +62,64 @@ drw_create(Display *dpy, int screen, Window root, unsigned int w, unsigned int h
 }
 
 void
-drw_resize(Drw *drw, unsigned int w, unsigned int h)
+drw_free(Drw *drw)
+{
+	XFreeGC(drw->dpy, drw->gc);
+	drw_fontset_free(drw->fonts);
+	free(drw);
+}
+
+/* Buffers are the pixmaps drawing happens on; the caller owns them and
+ * selects the current one with drw_setbuf.
+ */
+Buf *
+drw_buf_create(Drw *drw, unsigned int w, unsigned int h)
 {
+	Buf *buf;
+
 	if (!drw)
+		return NULL;
+
+	buf = ecalloc(1, sizeof(Buf));
+	buf->w = w;
+	buf->h = h;
+	buf->drawable = XCreatePixmap(drw->dpy, drw->root, w, h, DefaultDepth(drw->dpy, drw->screen));
+	buf->xftdraw = XftDrawCreate(drw->dpy, buf->drawable,
+	                             DefaultVisual(drw->dpy, drw->screen),
+	                             DefaultColormap(drw->dpy, drw->screen));
+
+	return buf;
+}
+
+void
+drw_buf_free(Drw *drw, Buf *buf)
+{
+	if (!drw || !buf)
 		return;
 
-	drw->w = w;
-	drw->h = h;
-	if (drw->drawable)
-		XFreePixmap(drw->dpy, drw->drawable);
-	drw->drawable = XCreatePixmap(drw->dpy, drw->root, w, h, DefaultDepth(drw->dpy, drw->screen));
+	if (drw->buf == buf)
+		drw->buf = NULL;
+	XftDrawDestroy(buf->xftdraw);
+	XFreePixmap(drw->dpy, buf->drawable);
+	free(buf);
 }
 
 void
-drw_free(Drw *drw)
+drw_resize(Drw *drw, Buf *buf, unsigned int w, unsigned int h)
 {
-	XFreePixmap(drw->dpy, drw->drawable);
-	XFreeGC(drw->dpy, drw->gc);
-	drw_fontset_free(drw->fonts);
-	free(drw);
+	if (!drw || !buf)
+		return;
+
+	buf->w = w;
+	buf->h = h;
+	if (buf->xftdraw)
+		XftDrawDestroy(buf->xftdraw);
+	if (buf->drawable)
+		XFreePixmap(drw->dpy, buf->drawable);
+	buf->drawable = XCreatePixmap(drw->dpy, drw->root, w, h, DefaultDepth(drw->dpy, drw->screen));
+	buf->xftdraw = XftDrawCreate(drw->dpy, buf->drawable,
+	                             DefaultVisual(drw->dpy, drw->screen),
+	                             DefaultColormap(drw->dpy, drw->screen));
 }
 
 /* This function is an implementation detail. Library users should use
@@ -136,9 +173,48 @@ xfont_free(Fnt *font)
 	if (font->pattern)
 		FcPatternDestroy(font->pattern);
 	XftFontClose(font->dpy, font->xfont);
+	free(font->glyphs);
 	free(font);
 }
 
+/* Returns the first font of the set which has a glyph for cp and stores its
+ * advance in w. Hits are cached on the head of the set; misses are not, so a
+ * fallback font appended later is still found.
+ */
+static Fnt *
+xfont_glyph(Drw *drw, long cp, const char *text, unsigned int len, int nocache, unsigned int *w)
+{
+	Fnt *set = drw->fonts, *f;
+	Gly *g = NULL;
+
+	if (!nocache) {
+		if (cp >= 0 && cp < LENGTH(set->ascii)) {
+			g = &set->ascii[cp];
+		} else {
+			if (!set->glyphs)
+				set->glyphs = ecalloc(GLYPH_CACHE, sizeof(Gly));
+			g = &set->glyphs[((unsigned long)cp * 2654435761UL) & (GLYPH_CACHE - 1)];
+		}
+		if (g->font && g->cp == cp) {
+			*w = g->w;
+			return g->font;
+		}
+	}
+
+	for (f = set; f; f = f->next) {
+		if (XftCharExists(drw->dpy, f->xfont, cp)) {
+			drw_font_getexts(f, text, len, w, NULL);
+			if (g) {
+				g->cp = cp;
+				g->font = f;
+				g->w = *w;
+			}
+			return f;
+		}
+	}
+	return NULL;
+}
+
 Fnt*
 drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount)
 {
@@ -232,16 +308,23 @@ drw_setscheme(Drw *drw, Clr *scm)
 		drw->scheme = scm;
 }
 
+void
+drw_setbuf(Drw *drw, Buf *buf)
+{
+	if (drw)
+		drw->buf = buf;
+}
+
 void
 drw_rect(Drw *drw, int x, int y, unsigned int w, unsigned int h, int filled, int invert)
 {
-	if (!drw || !drw->scheme)
+	if (!drw || !drw->scheme || !drw->buf)
 		return;
 	XSetForeground(drw->dpy, drw->gc, invert ? drw->scheme[ColBg].pixel : drw->scheme[ColFg].pixel);
 	if (filled)
-		XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
+		XFillRectangle(drw->dpy, drw->buf->drawable, drw->gc, x, y, w, h);
 	else
-		XDrawRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w - 1, h - 1);
+		XDrawRectangle(drw->dpy, drw->buf->drawable, drw->gc, x, y, w - 1, h - 1);
 }
 
 int
@@ -263,19 +346,17 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 	static unsigned int nomatches[128], ellipsis_width, invalid_width;
 	static const char invalid[] = "�";
 
-	if (!drw || (render && (!drw->scheme || !w)) || !text || !drw->fonts)
+	if (!drw || (render && (!drw->scheme || !drw->buf || !w)) || !text || !drw->fonts)
 		return 0;
 
 	if (!render) {
 		w = invert ? invert : ~invert;
 	} else {
 		XSetForeground(drw->dpy, drw->gc, drw->scheme[invert ? ColFg : ColBg].pixel);
-		XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
+		XFillRectangle(drw->dpy, drw->buf->drawable, drw->gc, x, y, w, h);
 		if (w < lpad)
 			return x + w;
-		d = XftDrawCreate(drw->dpy, drw->drawable,
-		                  DefaultVisual(drw->dpy, drw->screen),
-		                  DefaultColormap(drw->dpy, drw->screen));
+		d = drw->buf->xftdraw;
 		x += lpad;
 		w -= lpad;
 	}
@@ -290,35 +371,44 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 		utf8str = text;
 		nextfont = NULL;
 		while (*text) {
-			utf8charlen = utf8decode(text, &utf8codepoint, &utf8err);
-			for (curfont = drw->fonts; curfont; curfont = curfont->next) {
-				charexists = charexists || XftCharExists(drw->dpy, curfont->xfont, utf8codepoint);
-				if (charexists) {
-					drw_font_getexts(curfont, text, utf8charlen, &tmpw, NULL);
-					if (ew + ellipsis_width <= w) {
-						/* keep track where the ellipsis still fits */
-						ellipsis_x = x + ew;
-						ellipsis_w = w - ew;
-						ellipsis_len = utf8strlen;
-					}
-
-					if (ew + tmpw > w) {
-						overflow = 1;
-						/* called from drw_fontset_getwidth_clamp():
-						 * it wants the width AFTER the overflow
-						 */
-						if (!render)
-							x += tmpw;
-						else
-							utf8strlen = ellipsis_len;
-					} else if (curfont == usedfont) {
-						text += utf8charlen;
-						utf8strlen += utf8err ? 0 : utf8charlen;
-						ew += utf8err ? 0 : tmpw;
-					} else {
-						nextfont = curfont;
-					}
-					break;
+			if ((unsigned char)*text < 0x80) { /* ASCII fast path */
+				utf8codepoint = *text;
+				utf8charlen = 1;
+				utf8err = 0;
+			} else {
+				utf8charlen = utf8decode(text, &utf8codepoint, &utf8err);
+			}
+			if (charexists) {
+				/* no font has it, draw it with the first one */
+				curfont = drw->fonts;
+				drw_font_getexts(curfont, text, utf8charlen, &tmpw, NULL);
+			} else {
+				/* an invalid sequence is measured by its bytes, do not cache it */
+				curfont = xfont_glyph(drw, utf8codepoint, text, utf8charlen, utf8err, &tmpw);
+			}
+			if ((charexists = curfont != NULL)) {
+				if (ew + ellipsis_width <= w) {
+					/* keep track where the ellipsis still fits */
+					ellipsis_x = x + ew;
+					ellipsis_w = w - ew;
+					ellipsis_len = utf8strlen;
+				}
+
+				if (ew + tmpw > w) {
+					overflow = 1;
+					/* called from drw_fontset_getwidth_clamp():
+					 * it wants the width AFTER the overflow
+					 */
+					if (!render)
+						x += tmpw;
+					else
+						utf8strlen = ellipsis_len;
+				} else if (curfont == usedfont) {
+					text += utf8charlen;
+					utf8strlen += utf8err ? 0 : utf8charlen;
+					ew += utf8err ? 0 : tmpw;
+				} else {
+					nextfont = curfont;
 				}
 			}
 
@@ -399,20 +489,16 @@ no_match:
 			}
 		}
 	}
-	if (d)
-		XftDrawDestroy(d);
-
 	return x + (render ? w : 0);
 }
 
 void
 drw_map(Drw *drw, Window win, int x, int y, unsigned int w, unsigned int h)
 {
-	if (!drw)
+	if (!drw || !drw->buf)
 		return;
 
-	XCopyArea(drw->dpy, drw->drawable, win, drw->gc, x, y, w, h, x, y);
-	XSync(drw->dpy, False);
+	XCopyArea(drw->dpy, drw->buf->drawable, win, drw->gc, x, y, w, h, x, y);
 }
 
 unsigned int
@@ -4,12 +4,20 @@ typedef struct {
 	Cursor cursor;
 } Cur;
 
+typedef struct {
+	long cp;
+	struct Fnt *font;     /* first font of the set covering cp */
+	unsigned int w;       /* advance of cp in that font */
+} Gly;
+
 typedef struct Fnt {
 	Display *dpy;
 	unsigned int h;
 	XftFont *xfont;
 	FcPattern *pattern;
 	struct Fnt *next;
+	Gly ascii[128];       /* glyph cache, used on the head of a set */
+	Gly *glyphs;          /* GLYPH_CACHE slots for non-ASCII, lazily allocated */
 } Fnt;
 
 enum { ColFg, ColBg, ColBorder }; /* Clr scheme index */
@@ -17,20 +25,29 @@ typedef XftColor Clr;
 
 typedef struct {
 	unsigned int w, h;
+	Drawable drawable;
+	XftDraw *xftdraw;     /* bound to drawable for its whole lifetime */
+} Buf;
+
+typedef struct {
 	Display *dpy;
 	int screen;
 	Window root;
-	Drawable drawable;
+	Buf *buf;
 	GC gc;
 	Clr *scheme;
 	Fnt *fonts;
 } Drw;
 
 /* Drawable abstraction */
-Drw *drw_create(Display *dpy, int screen, Window win, unsigned int w, unsigned int h);
-void drw_resize(Drw *drw, unsigned int w, unsigned int h);
+Drw *drw_create(Display *dpy, int screen, Window win);
 void drw_free(Drw *drw);
 
+/* Buffer abstraction */
+Buf *drw_buf_create(Drw *drw, unsigned int w, unsigned int h);
+void drw_buf_free(Drw *drw, Buf *buf);
+void drw_resize(Drw *drw, Buf *buf, unsigned int w, unsigned int h);
+
 /* Fnt abstraction */
 Fnt *drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount);
 void drw_fontset_free(Fnt* set);
@@ -51,6 +68,7 @@ void drw_cur_free(Drw *drw, Cur *cursor);
 /* Drawing context manipulation */
 void drw_setfontset(Drw *drw, Fnt *set);
 void drw_setscheme(Drw *drw, Clr *scm);
+void drw_setbuf(Drw *drw, Buf *buf);
 
 /* Drawing functions */
 void drw_rect(Drw *drw, int x, int y, unsigned int w, unsigned int h, int filled, int invert);
@@ -21,6 +21,8 @@
  * To understand everything else, start reading main().
  */
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <locale.h>
 #include <math.h>
 #include <signal.h>
@@ -29,13 +31,22 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <X11/cursorfont.h>
 #include <X11/keysym.h>
 #include <X11/Xatom.h>
 #include <X11/Xlib.h>
+#include <X11/Xlib-xcb.h>
 #include <X11/Xproto.h>
 #include <X11/Xutil.h>
 #ifdef XINERAMA
@@ -44,6 +55,7 @@
 #include <X11/Xft/Xft.h>
 
 #include "drw.h"
+#include "ipc.h"
 #include "util.h"
 
 /* macros */
@@ -58,9 +70,35 @@
 #define HEIGHT(X)               ((X)->h + 2 * (X)->bw)
 #define TEXTW(X)                (drw_fontset_getwidth(drw, (X)) + lrpad)
 #define TAG_UNIT                1ULL
+#define BAR_OPS_MAX             64
+#define CLASS_HASH_SIZE         64  /* power of two */
+#define SNAP_MAGIC              0x64776d31  /* "dwm1" */
+#define SNAP_CLASSES_MAX        4096        /* sanity limits of a snapshot */
+#define SNAP_MONS_MAX           64
+#define SNAP_CLIENTS_MAX        (1 << 16)
+#define REQ_RING                256 /* client request batches, power of two */
+/* worst case of _drawbar(): classes and their two ellipses or the
+ * version, tags, their two ellipses and the separator, urgent clients and
+ * their separator, layout, status and modules with a separator each,
+ * clients, their two ellipses and the fill; and the gap _bar_span()
+ * ends with when that is exceeded */
+#define BAR_SPANS_MAX           (BAR_CLASS_MAX + 2 + BAR_TAG_MAX + 3 \
+                                 + BAR_URGENT_MAX + 1 + 2 \
+                                 + 2 * (1 + LENGTH(smodules)) \
+                                 + BAR_CLIENT_MAX + 3 + 1)
+#define METRIC_BUCKETS          20  /* log2 of us, the last one open */
+#define MEASURE(met, arg, ...)  do { unsigned long a_ = (arg); \
+                                     uint64_t t0_ = nsnow(); \
+                                     ulong r0_ = NextRequest(dpy), rt0_ = roundtrips; \
+                                     __VA_ARGS__; \
+                                     measured(met, a_, t0_, r0_, rt0_); } while (0)
 
 /* enums */
 enum { CurNormal, CurResize, CurMove, CurLast }; /* cursor */
+enum { DirtyArrange, DirtyRestack, DirtyBar, DirtyStatus, DirtyExport,
+       DirtyLast }; /* deferred work */
+enum { PropClass, PropTransient, PropNetName, PropName, PropState,
+       PropType, PropNormalHints, PropHints, PropLast }; /* manage() reads */
 enum { SchemeNormal, SchemeClass, SchemeTag,
 	   SchemeClntLbl, SchemeUrgent, SchemeStatus,
 	   SchemeLayout, SchemeNmaster, SchemeMfact }; /* color schemes */
@@ -70,6 +108,17 @@ enum { NetSupported, NetWMName, NetWMState, NetWMCheck,
 enum { WMProtocols, WMDelete, WMState, WMTakeFocus, WMLast }; /* default atoms */
 enum { ClkClass, ClkDesktop, ClkTag, ClkLayout, ClkLayoutParam,
 	   ClkClientList, ClkClientWin, ClkRootWin, ClkLast }; /* clicks */
+enum { IpcArgNone, IpcArgInt, IpcArgFloat, IpcArgTag,
+       IpcArgShorts }; /* IPC command arguments */
+enum { FdX, FdIpc, FdStatus, FdTimer, FdSignal, FdClients }; /* fds, IPC clients last */
+enum { TimerStatus, TimerModules, TimerLast }; /* timers */
+enum { MetArrange, MetRestack, MetDrawbar, MetManage, MetUnmanage,
+       MetEvent, MetLast = MetEvent + LASTEvent }; /* metrics, MetEvent + type */
+enum { SegClass, SegTag, SegUrgent, SegLayout, SegStatus,
+	   SegClient, SegLast }; /* bar segments */
+enum { SpanClassL, SpanClass, SpanClassR, SpanTagL, SpanTag, SpanTagR,
+	   SpanUrgent, SpanLayout, SpanLayoutParam, SpanStatus, SpanModules,
+	   SpanClientL, SpanClient, SpanClientR, SpanGap, SpanLast }; /* bar spans */
 
 typedef unsigned long long tag_t;
 
@@ -91,6 +140,35 @@ typedef struct {
 	const Arg arg;
 } Button;
 
+typedef struct {
+	int x0, x1;           /* last drawn x-range */
+	uint64_t hash;        /* fingerprint of the last drawn content, 0 if none */
+} BarSeg;
+
+typedef struct {
+	Clr *scm;
+	const char *text;     /* NULL for a rectangle */
+	int x, y, w, h;
+	int arg, invert;      /* lpad for text, filled for a rectangle */
+} BarOp;
+
+typedef struct Class Class;
+typedef struct Client Client;
+
+typedef struct {
+	int x;                /* right edge, the left one is the previous span's */
+	uint type;            /* SpanClass, ... */
+	Class *cls;
+	Client *c;
+	tag_t t;
+} BarSpan;
+
+typedef struct {
+	Client *c;
+	int x, y, w, h;       /* with size hints applied */
+	int bw;
+} Geom;
+
 typedef struct LayoutParams LayoutParams;
 struct LayoutParams {
 	int nmaster;
@@ -98,9 +176,11 @@ struct LayoutParams {
 	uint lt_idx;
 };
 
-typedef struct Class Class;
 struct Class {
-	Class *next;
+	Class *next, *prev;
+	Class *hnext;  /* classtab bucket chain */
+	int idx;       /* position in classes, see _class_renumber() */
+	int nclients;
 
 	char name[256];
 	int w_name;
@@ -116,7 +196,6 @@ typedef struct {
 
 typedef struct Monitor Monitor;
 typedef struct Desktop Desktop;
-typedef struct Client Client;
 struct Client {
 	char name[256];
 	float mina, maxa;
@@ -124,6 +203,7 @@ struct Client {
 	int oldx, oldy, oldw, oldh;
 	int basew, baseh, incw, inch, maxw, maxh, minw, minh, hintsvalid;
 	int bw, oldbw;
+	int sentbw;           /* border width the server has, bw may be newer */
 	int isfixed, isfloating, isurgent, neverfocus, oldstate, isfullscreen;
 	Client *next;
 	Client *snext;
@@ -143,6 +223,45 @@ typedef struct {
 	const Arg arg;
 } Key;
 
+typedef struct {
+	void (*func)(const Arg *);
+	uint argtype;         /* IpcArgNone, ... */
+} IpcCommand;
+
+typedef struct {
+	int fd[2];            /* kept open, read with pread() */
+	unsigned long long prev[2];
+	char text[64];
+} ModState;
+
+typedef struct {
+	void (*func)(ModState *ms, const char *arg);
+	const char *arg;
+	uint interval;        /* seconds between samples */
+} StatusModule;
+
+typedef struct {
+	uint64_t mask;        /* subscribed 1 << IpcEv..., or 0 */
+	IpcEvent *queue;      /* IPC_QUEUE events, allocated on subscription */
+	uint head, tail;      /* head - tail events are pending */
+	uint32_t dropped;
+} IpcClient;
+
+typedef struct {
+	ulong count, requests;
+	ulong roundtrips, rtmax, rtover;  /* counted with AUDIT */
+	uint64_t ns;
+	ulong hist[METRIC_BUCKETS + 1];  /* below 1 << i us, then the rest */
+} Metric;
+
+#ifdef TRACE
+typedef struct {
+	const char *name;
+	unsigned long arg;
+	uint64_t ts, dur;     /* CLOCK_MONOTONIC ns */
+} TraceEvent;
+#endif /* TRACE */
+
 typedef struct {
 	const char *symbol;
 	void (*arrange)(Monitor *);
@@ -151,6 +270,7 @@ typedef struct {
 struct Monitor {
 	Monitor *next;
 	Window barwin;
+	Buf *barbuf;          /* bar-sized pixmap the bar is drawn on */
 
 	Client *clients, *stack, *sel;
 	Class *curcls, *prevcls;
@@ -164,18 +284,19 @@ struct Monitor {
 	char ltsymbol[16];
 	int topbar;
 	uint showbar;
-
-	int x_class_ellipsis_l;
-	int x_class_ellipsis_r;
-	int x_tag_ellipsis_l;
-	int x_tag_ellipsis_r;
-	tag_t tag_ellipsis_l;
-	tag_t tag_ellipsis_r;
-	int x_layout;
-	int x_layout_param;
-	int x_status_text;
-	int x_client_ellipsis_l;
-	int x_client_ellipsis_r;
+	uint dirty;           /* DirtyArrange, ... bits, flushed per batch */
+	BarSeg segs[SegLast];
+
+	BarSpan *spans;  /* hit-test map, BAR_SPANS_MAX, sorted by x */
+	Window *stackwins;    /* stacking order last applied, the bar first */
+	int nstackwins, stackwinsz;
+	tag_t evtags;         /* view last sent to subscribers */
+	Class *evcls;
+	LayoutParams *lp;  /* _layout_params() of the lptags view */
+	tag_t lptags;
+	ulong lpgen;
+	int nspans;
+	int statusspan, statusspans;  /* spans of the status segment */
 };
 
 typedef struct {
@@ -187,6 +308,47 @@ typedef struct {
 	int monitor;
 } Rule;
 
+typedef struct {
+	Window win;
+	Client *c;            /* managed client, or */
+	Monitor *m;           /* monitor owning the bar window */
+} WinRef;
+
+typedef struct {
+	ulong first, last;    /* serials of the requests */
+	Client *c;            /* NULL for unmanaged or several windows */
+} ReqBatch;
+
+/* reload snapshot: a SnapHeader followed by nclasses SnapClass,
+ * nmons SnapMon, nclients SnapClient in client list order and
+ * nclients Windows in focus stack order */
+typedef struct {
+	uint32_t magic, size;     /* SNAP_MAGIC, sizeof(SnapClient) */
+	struct timespec reloadts;
+	int nclasses, nmons, nclients, selmon;
+} SnapHeader;
+
+typedef struct {
+	char name[256];
+	LayoutParams params;
+} SnapClass;
+
+typedef struct {
+	int num;
+	tag_t curtags, prevtags;
+	int curcls, prevcls;      /* index into the SnapClass records or -1 */
+	uint showbar;
+} SnapMon;
+
+typedef struct {
+	Window win;
+	int mon, cls;
+	tag_t tags;
+	LayoutParams params;
+	int x, y, w, h;
+	int isfloating;
+} SnapClient;
+
 /* function declarations */
 static void applyrules(Client *c, const char *class, const char *instance);
 static int applysizehints(Client *c, int *x, int *y, int *w, int *h, int interact);
@@ -194,6 +356,10 @@ static void arrange(Monitor *m);
 static void arrangemon(Monitor *m);
 static void attach(Client *c);
 static void attachstack(Client *c);
+#ifdef AUDIT
+static int auditafter(Display *d);
+static void auditreport(void);
+#endif /* AUDIT */
 static void banish_pointer(const Arg *arg);
 static void buttonpress(XEvent *e);
 static void checkotherwm(void);
@@ -202,7 +368,9 @@ static void class_select(const Arg *arg);
 static void class_stack(const Arg *arg);
 static void class_swap(const Arg *arg);
 static void cleanup(void);
+static void cleanupipc(void);
 static void cleanupmon(Monitor *mon);
+static void cleanupshm(void);
 static void clear_status_text(const Arg *arg);
 static void clientmessage(XEvent *e);
 static void client_remove_tags(const Arg *arg);
@@ -219,16 +387,19 @@ static void detach(Client *c);
 static void detachstack(Client *c);
 static Monitor *dirtomon(int dir);
 static void drawbar(Monitor *m);
+static void _drawbar(Monitor *m);
+static void _drawstatus(Monitor *m);
+static BarSpan *_bar_span_at(Monitor *m, int x);
 static void drawbars(void);
 static void enternotify(XEvent *e);
 static void expose(XEvent *e);
+static void flushdirty(void);
 static void focus(Client *c);
 static void focusin(XEvent *e);
 static void focusmon(const Arg *arg);
 static void focusstack(const Arg *arg);
 static Atom getatomprop(Client *c, Atom prop);
 static int getrootptr(int *x, int *y);
-static long getstate(Window w);
 static int gettextprop(Window w, Atom atom, char *text, uint size);
 static void grabbuttons(Client *c, int focused);
 static void grabkeys(void);
@@ -239,38 +410,82 @@ static void group_select(const Arg *arg);
 static void group_stack(const Arg *arg);
 static void group_swap(const Arg *arg);
 static void incnmaster(const Arg *arg);
+static void ipcaccept(void);
+static void ipcdiff(void);
+static void ipcdrop(int i);
+static void ipcevent(uint type, Client *c, Monitor *m, uint64_t arg);
+static void ipcflush(int i);
+static void ipcmessage(int i);
 static void keypress(XEvent *e);
 static void killclient(const Arg *arg);
+static int loadstate(void);
 static void manage(Window w, XWindowAttributes *wa);
+static void measured(int met, unsigned long arg, uint64_t t0, ulong r0, ulong rt0);
+static void metricsdump(const Arg *arg);
+static void _manage(Window w, XWindowAttributes *wa, xcb_get_property_cookie_t *ck, int adopt);
 static void mappingnotify(XEvent *e);
 static void maprequest(XEvent *e);
 static void monocle(Monitor *m);
 static void motionnotify(XEvent *e);
 static void movemouse(const Arg *arg);
 static Client *nexttiled(Client *c);
+static uint64_t nsnow(void);
+static Geom *plan(Client *c, int x, int y, int w, int h);
+static void plancommit(void);
 static void pop(Client *c);
+static void publishstate(void);
 static void propertynotify(XEvent *e);
 static void quit(const Arg *arg);
 static Monitor *recttomon(int x, int y, int w, int h);
 static void reload(const Arg *arg);
+static void _req_batch(Client *c, ulong first);
+static ReqBatch *_req_find(ulong serial);
+static void _req_forget(Client *c);
 static void resize(Client *c, int x, int y, int w, int h, int interact);
 static void resizeclient(Client *c, int x, int y, int w, int h);
 static void resizemouse(const Arg *arg);
 static void restack(Monitor *m);
+static void _restack(Monitor *m);
+static void _restack_fence(void);
+static void _restack_put(Monitor *m, int i, Window w, int *first, int *last);
 static void run(void);
+static void savestate(void);
 static void scan(void);
 static int sendevent(Client *c, Atom proto);
 static void sendmon(Client *c, Monitor *m);
 static void setclientstate(Client *c, long state);
+static void setdirty(Monitor *m, uint flags);
 static void setfocus(Client *c);
 static void setfullscreen(Client *c, int fullscreen);
+static void settimer(int t, long ms);
 static void setlayout(const Arg *arg);
 static void setmfact(const Arg *arg);
 static void setup(void);
+static void setupevents(void);
+static void setupipc(void);
+static void setupshm(void);
+static void setupstatus(void);
+static void setupmodules(void);
 static void seturgent(Client *c, int urg);
 static void showhide(Client *c);
+static void sigread(void);
+static void setstatus(const char *text, size_t len);
 static void spawn(const Arg *arg);
+static void statusflush(void);
+static void statusread(void);
+static void statustick(void);
+static void status_battery(ModState *ms, const char *arg);
+static void status_clock(ModState *ms, const char *arg);
+static void status_cpu(ModState *ms, const char *arg);
+static void status_load(ModState *ms, const char *arg);
+static void status_mem(ModState *ms, const char *arg);
 static void tagmon(const Arg *arg);
+static void tracedump(const Arg *arg);
+#ifdef TRACE
+static void tracerec(const char *name, unsigned long arg, uint64_t t0, uint64_t t1);
+#endif /* TRACE */
+static void _timer_arm(void);
+static void timerrun(void);
 static void tag_adjacent(const Arg *arg);
 static void tag_remove(const Arg *arg);
 static void tag_select(const Arg *arg);
@@ -293,15 +508,20 @@ static void updateclientlist(void);
 static int updategeom(void);
 static void updatenumlockmask(void);
 static void updatesizehints(Client *c);
+static void _updatesizehints(Client *c, XSizeHints *size);
 static void updatestatus(void);
 static void updatetitle(Client *c);
 static void updatewindowtype(Client *c);
+static void _updatewindowtype(Client *c, Atom state, Atom wtype);
 static void updatewmhints(Client *c);
+static void watchfd(int i, int fd, uint events);
+static void _updatewmhints(Client *c, XWMHints *wmh);
 static Client *wintoclient(Window w);
 static Monitor *wintomon(Window w);
 static int xerror(Display *dpy, XErrorEvent *ee);
 static int xerrordummy(Display *dpy, XErrorEvent *ee);
 static int xerrorstart(Display *dpy, XErrorEvent *ee);
+static void xsync(void);
 static void zoom(const Arg *arg);
 
 /* variables */
@@ -329,20 +549,106 @@ static void (*handler[LASTEvent]) (XEvent *) = {
 	[PropertyNotify] = propertynotify,
 	[UnmapNotify] = unmapnotify
 };
+static const char *const metname[MetLast] = {
+	[MetArrange] = "arrange",
+	[MetRestack] = "restack",
+	[MetDrawbar] = "drawbar",
+	[MetManage] = "manage",
+	[MetUnmanage] = "unmanage",
+	[MetEvent + ButtonPress] = "ButtonPress",
+	[MetEvent + ClientMessage] = "ClientMessage",
+	[MetEvent + ConfigureRequest] = "ConfigureRequest",
+	[MetEvent + ConfigureNotify] = "ConfigureNotify",
+	[MetEvent + DestroyNotify] = "DestroyNotify",
+	[MetEvent + EnterNotify] = "EnterNotify",
+	[MetEvent + Expose] = "Expose",
+	[MetEvent + FocusIn] = "FocusIn",
+	[MetEvent + KeyPress] = "KeyPress",
+	[MetEvent + MappingNotify] = "MappingNotify",
+	[MetEvent + MapRequest] = "MapRequest",
+	[MetEvent + MotionNotify] = "MotionNotify",
+	[MetEvent + PropertyNotify] = "PropertyNotify",
+	[MetEvent + UnmapNotify] = "UnmapNotify"
+};
+static Metric metrics[MetLast];
+static ulong nsyncs;             /* XSync() calls */
+static Geom *plans;              /* geometry planned by the layout */
+static int nplans, plansz;
+static ulong restackskip;        /* restacks with nothing to change */
+static ulong enterserial;        /* last request of a restack, see _restack_fence() */
+static ReqBatch reqring[REQ_RING]; /* recent client requests, for xerror() */
+static uint reqhead;
+static ulong roundtrips;         /* waits for the server, with AUDIT */
+#ifdef AUDIT
+static ulong rtseen;             /* LastKnownRequestProcessed() */
+#endif /* AUDIT */
 static Atom wmatom[WMLast], netatom[NetLast];
 static int running = 1;
 static Cur *cursor[CurLast];
 static Clr **scheme;
 static Display *dpy;
+static xcb_connection_t *xcon;  /* dpy's connection, for pipelined requests */
 static Drw *drw;
 static Monitor *mons, *selmon;
 static Window root, wmcheckwin;
-static Class *classes;
+static Class *classes, *classtail;
+static Class *classtab[CLASS_HASH_SIZE];
+static int nclasses;
+static int classmoved;           /* Class idx out of date */
+static ulong dirtyreq[DirtyLast], dirtyrun[DirtyLast];
+static ulong lpgen = 1;  /* bumped when client order or tags change */
+static ulong focusbars, focusbarsall;  /* bars marked by focus() / monitors */
+static ulong focusmoves;         /* of those, for a selmon change */
+static Monitor *barselmon;       /* bar last marked as selmon by focus() */
+static WinRef *wintab;       /* open addressing, linear probing */
+static size_t wintabsz, wintabcnt;
+static BarOp barops[BAR_OPS_MAX];  /* pending drawing of the current segment */
+static int nbarops, barx0, barforce;
+static uint64_t barhash;
+static uint bardone;               /* segments ended in the current drawbar() */
+static int bardmg[SegLast][2], nbardmg;
 
 /* configuration, allows nested code to access above variables */
 #include "config.h"
 
-static char stext[BAR_STATUS_LENGTH];
+static const ClassRule *cruletab[CLASS_HASH_SIZE];
+static const ClassRule *crulenext[LENGTH(crules)];  /* by crules index */
+static SnapClient *snapc;    /* reload snapshot, while scan() adopts */
+static Window *snapstack;
+static int *snapbywin, nsnapc;
+static Class **snapcls;
+static int nsnapcls;
+static struct timespec reloadts;  /* reload() time, until the first paint */
+static int fds[FdClients + IPC_CLIENTS_MAX];  /* watched by run(), -1 if not */
+static uint fdevents[LENGTH(fds)];
+static int epfd = -1;
+static struct timespec timers[TimerLast];     /* monotonic deadline, 0 if off */
+static int timersdirty;                       /* timerfd to be rearmed */
+static void (*const timerfunc[TimerLast])(void) = {
+	[TimerStatus] = statusflush,
+	[TimerModules] = statustick,
+};
+static char ipcpath[PATH_MAX];
+static IpcClient ipcclients[IPC_CLIENTS_MAX];  /* of fds[FdClients], ... */
+static char statuspath[PATH_MAX];
+static char *statusin;           /* partial line read from the status FIFO */
+static size_t statusinlen;
+static int statusdiscard;        /* dropping an over-long line up to its newline */
+static int statusdirty;          /* new status, not painted yet */
+static struct timespec statusts; /* last status paint */
+static ModState mstate[LENGTH(smodules)];
+static unsigned long long statusticks;
+static Window evwin;             /* focus last sent to subscribers */
+static int evmon = -1;
+static ShmState *shm;            /* published state, see ipc.h */
+static char shmpath[PATH_MAX];
+#ifdef TRACE
+static TraceEvent tracering[TRACE_EVENTS];  /* last TRACE_EVENTS calls */
+static unsigned long tracen;
+#endif /* TRACE */
+
+static char *stext;              /* status text, stextsz bytes allocated */
+static size_t stextsz;
 const char ellipsis_l[] = "<";
 const char ellipsis_r[] = ">";
 const char urgent_v[] = "Urg";
@@ -352,34 +658,35 @@ int w_clabels[LENGTH(clabels)];
 char tlabels[sizeof(tag_t) * 8][5];
 int w_tlabels[sizeof(tag_t) * 8];
 
-struct {
-	int x;
-	Class *cls;
-} classclick[BAR_CLASS_MAX];
-struct {
-	int x;
-	tag_t tag;
-} tagclick[BAR_TAG_MAX];
-struct {
-	int x;
-	Client *c;
-} urgentclick[BAR_URGENT_MAX];
-struct {
-	int x;
-	Client *c;
-} clientclick[BAR_CLIENT_MAX];
-
 const char dwm_version[] = "dwm " VERSION;
 int w_dwm_version;
 int return_code = EXIT_SUCCESS;
 
+uint64_t
+_fnv1a(uint64_t h, const void *p, size_t n)
+{
+	const unsigned char *b = p;
+
+	while (n--)
+		h = (h ^ *b++) * 0x100000001b3ULL;
+	return h;
+}
+
 LayoutParams *
 _layout_params(Monitor *m)
 {
 	if (m->curtags) {
+		if (m->lpgen == lpgen && m->lptags == m->curtags)
+			return m->lp;
+		m->lpgen = lpgen;
+		m->lptags = m->curtags;
+		m->lp = &default_lt_params;
 		for (Client *c = m->clients; c; c = c->next)
-			if (c->tags & m->curtags)
-				return &c->params;
+			if (c->tags & m->curtags) {
+				m->lp = &c->params;
+				break;
+			}
+		return m->lp;
 	} else {
 		if (m->curcls)
 			return &m->curcls->params;
@@ -394,24 +701,65 @@ _current_layout(Monitor *m)
 	return &layouts[p->lt_idx];
 }
 
+uint
+_class_hash(const char *name)
+{
+	return _fnv1a(0xcbf29ce484222325ULL, name, strlen(name)) & (CLASS_HASH_SIZE - 1);
+}
+
+/* Brings Class idx up to date after the list changed. publishstate()
+ * numbers the classes as it exports them, so this only runs for readers
+ * in between. */
+void
+_class_renumber(void)
+{
+	int i = 0;
+
+	if (!classmoved)
+		return;
+	for (Class *cls = classes; cls; cls = cls->next)
+		cls->idx = i++;
+	classmoved = 0;
+}
+
+/* Links cls in before next, at the end for NULL. */
+void
+_class_attach(Class *cls, Class *next)
+{
+	cls->next = next;
+	cls->prev = next ? next->prev : classtail;
+	if (cls->prev)
+		cls->prev->next = cls;
+	else
+		classes = cls;
+	if (next)
+		next->prev = cls;
+	else
+		classtail = cls;
+	nclasses++;
+	classmoved = 1;
+}
+
 void
 _class_detach(Class *cls)
 {
-	Class **cpp;
-	for (cpp = &classes; *cpp && *cpp != cls; cpp = &(*cpp)->next);
-	*cpp = cls->next;
+	if (cls->prev)
+		cls->prev->next = cls->next;
+	else
+		classes = cls->next;
+	if (cls->next)
+		cls->next->prev = cls->prev;
+	else
+		classtail = cls->prev;
+	cls->next = cls->prev = NULL;
+	nclasses--;
+	classmoved = 1;
 }
 
 void
-_class_delete_if_empty(Client *c)
+_class_free(Class *cls)
 {
-	Class *cls = c->class;
-	for (Monitor *m = mons; m; m = m->next) {
-		for (Client *c2 = m->clients; c2; c2 = c2->next) {
-			if (c2 != c && c2->class == cls)
-				return;
-		}
-	}
+	Class **cpp;
 
 	for (Monitor *m = mons; m; m = m->next) {
 		if (m->curcls == cls)
@@ -420,43 +768,58 @@ _class_delete_if_empty(Client *c)
 			m->prevcls = NULL;
 	}
 
+	for (cpp = &classtab[_class_hash(cls->name)]; *cpp != cls; cpp = &(*cpp)->hnext);
+	*cpp = cls->hnext;
 	_class_detach(cls);
 	free(cls);
 }
 
+void
+_class_unref(Client *c)
+{
+	if (--c->class->nclients == 0)
+		_class_free(c->class);
+}
+
+/* Appends a class, name must not be registered yet. */
+Class *
+_class_new(const char *name, const LayoutParams *params)
+{
+	Class *cls = ecalloc(1, sizeof(Class));
+	uint h;
+
+	_class_attach(cls, NULL);
+
+	snprintf(cls->name, sizeof(cls->name), "%s", name);
+	cls->w_name = TEXTW(cls->name);
+	h = _class_hash(cls->name);
+	cls->hnext = classtab[h];
+	classtab[h] = cls;
+	cls->params = *params;
+
+	return cls;
+}
+
 Class *
 _class_find_or_create(const char *class)
 {
 	const char *name = class;
-	const LayoutParams *params = NULL;
-	for (int i = 0; i < LENGTH(crules); i++) {
-		if (strcmp(class, crules[i].class) == 0) {
-			name = strlen(crules[i].rename) ? crules[i].rename : class;
-			params = &crules[i].params;
+	const ClassRule *r;
+	Class *cls;
+	uint h;
+
+	for (r = cruletab[_class_hash(class)]; r; r = crulenext[r - crules])
+		if (strcmp(class, r->class) == 0) {
+			name = strlen(r->rename) ? r->rename : class;
 			break;
 		}
-	}
 
-	Class *cls = classes;
-	for (; cls; cls = cls->next) {
+	h = _class_hash(name);
+	for (cls = classtab[h]; cls; cls = cls->hnext)
 		if (strcmp(cls->name, name) == 0)
 			return cls;
-	}
-
-	cls = ecalloc(1, sizeof(Class));
-	Class **cpp = &classes;
-	for (; *cpp; cpp = &(*cpp)->next);
-	*cpp = cls;
-
-	snprintf(cls->name, sizeof(cls->name), "%s", name);
-	cls->w_name = TEXTW(cls->name);
-
-	if (params)
-		cls->params = *params;
-	else
-		cls->params = default_lt_params;
 
-	return cls;
+	return _class_new(name, r ? &r->params : &default_lt_params);
 }
 
 void
@@ -482,9 +845,7 @@ _class_select(Class *cls)
 Class *
 _class_tail()
 {
-	Class *cls = classes;
-	for (; cls && cls->next; cls = cls->next);
-	return cls;
+	return classtail;
 }
 
 void
@@ -547,6 +908,7 @@ _tag_insert(Monitor *m, int relative, int append, int tag_sel)
 
 	if (tag_sel && m->sel)
 		m->sel->tags = m->curtags;
+	lpgen++;
 
 	focus(NULL);
 	arrange(m);
@@ -586,11 +948,90 @@ _tag_remove(Monitor *m, int force)
 	}
 
 	m->curtags = TAG_UNIT;
+	lpgen++;
 
 	focus(NULL);
 	arrange(m);
 }
 
+#define WINTAB_SLOT(W)          ((size_t)((W) * 2654435761UL) & (wintabsz - 1))
+
+WinRef *
+_wintab_find(Window w)
+{
+	size_t i;
+
+	if (!wintabsz)
+		return NULL;
+	for (i = WINTAB_SLOT(w); wintab[i].win; i = (i + 1) & (wintabsz - 1))
+		if (wintab[i].win == w)
+			return &wintab[i];
+	return NULL;
+}
+
+WinRef *
+_wintab_slot_free(Window w)
+{
+	size_t i;
+
+	for (i = WINTAB_SLOT(w); wintab[i].win; i = (i + 1) & (wintabsz - 1));
+	return &wintab[i];
+}
+
+void
+_wintab_put(Window w, Client *c, Monitor *m)
+{
+	WinRef *old = wintab, *r;
+	size_t i, oldsz = wintabsz;
+
+	if ((r = _wintab_find(w))) {
+		r->c = c;
+		r->m = m;
+		return;
+	}
+
+	/* keep the load factor below 3/4 */
+	if ((wintabcnt + 1) * 4 > wintabsz * 3) {
+		wintabsz = wintabsz ? wintabsz * 2 : 64;
+		wintab = ecalloc(wintabsz, sizeof(WinRef));
+		for (i = 0; i < oldsz; i++)
+			if (old[i].win)
+				*_wintab_slot_free(old[i].win) = old[i];
+		free(old);
+	}
+
+	r = _wintab_slot_free(w);
+	r->win = w;
+	r->c = c;
+	r->m = m;
+	wintabcnt++;
+}
+
+void
+_wintab_del(Window w)
+{
+	WinRef *r = _wintab_find(w);
+	size_t i, j, k;
+
+	if (!r)
+		return;
+
+	/* backward shift deletion, no tombstones */
+	i = j = r - wintab;
+	for (;;) {
+		j = (j + 1) & (wintabsz - 1);
+		if (!wintab[j].win)
+			break;
+		k = WINTAB_SLOT(wintab[j].win);
+		if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+			continue;
+		wintab[i] = wintab[j];
+		i = j;
+	}
+	memset(&wintab[i], 0, sizeof(WinRef));
+	wintabcnt--;
+}
+
 /* function implementations */
 void
 applyrules(Client *c, const char *class, const char *instance)
@@ -692,14 +1133,9 @@ void
 arrange(Monitor *m)
 {
 	if (m)
-		showhide(m->stack);
+		setdirty(m, 1 << DirtyArrange | 1 << DirtyRestack | 1 << DirtyBar);
 	else for (m = mons; m; m = m->next)
-		showhide(m->stack);
-	if (m) {
-		arrangemon(m);
-		restack(m);
-	} else for (m = mons; m; m = m->next)
-		arrangemon(m);
+		setdirty(m, 1 << DirtyArrange);
 }
 
 void
@@ -710,8 +1146,11 @@ arrangemon(Monitor *m)
 		return;
 
 	strncpy(m->ltsymbol, lt->symbol, sizeof m->ltsymbol);
-	if (lt->arrange)
+	if (lt->arrange) {
+		nplans = 0;
 		lt->arrange(m);
+		plancommit();
+	}
 }
 
 void
@@ -720,6 +1159,7 @@ attach(Client *c)
 	Monitor *m = c->mon;
 	c->next = m->clients;
 	m->clients = c;
+	lpgen++;
 }
 
 void
@@ -730,6 +1170,35 @@ attachstack(Client *c)
 	m->stack = c;
 }
 
+#ifdef AUDIT
+/* Runs after every Xlib request. Xlib reads from the server mostly to
+ * wait for a reply, so the last processed request catching up with the
+ * last one sent is counted as a round trip. A heuristic: replies to the
+ * pipelined xcb requests of manage() are not seen here. */
+int
+auditafter(Display *d)
+{
+	ulong seen = LastKnownRequestProcessed(d);
+
+	if (seen != rtseen && seen == NextRequest(d) - 1)
+		roundtrips++;
+	rtseen = seen;
+	return 0;
+}
+
+void
+auditreport(void)
+{
+	fprintf(stderr, "dwm: %-18s %8s %10s %5s %6s %8s\n",
+		"round trips", "calls", "total", "max", "budget", "over");
+	for (int i = 0; i < MetLast; i++)
+		if (metname[i] && metrics[i].count)
+			fprintf(stderr, "dwm: %-18s %8lu %10lu %5lu %6d %8lu\n", metname[i],
+				metrics[i].count, metrics[i].roundtrips, metrics[i].rtmax,
+				rtbudget[i], metrics[i].rtover);
+}
+#endif /* AUDIT */
+
 void
 banish_pointer(const Arg *arg)
 {
@@ -758,10 +1227,13 @@ buttonpress(XEvent *e)
 {
 	uint i, click = ClkRootWin;
 	Arg arg = {0};
+	BarSpan *sp;
 	Client *c;
 	Monitor *m;
 	XButtonPressedEvent *ev = &e->xbutton;
 
+	/* resolve the click against what is actually on screen */
+	flushdirty();
 	/* focus monitor if necessary */
 	if ((m = wintomon(ev->window)) && m != selmon) {
 		unfocus(selmon->sel, 1);
@@ -769,100 +1241,75 @@ buttonpress(XEvent *e)
 		focus(NULL);
 	}
 	if (ev->window == selmon->barwin) {
-		if (ev->x < selmon->x_class_ellipsis_l) {
+		sp = _bar_span_at(selmon, ev->x);
+		switch (sp ? sp->type : SpanLast) {
+		case SpanClassL:
 			if (ev->button == Button1)
 				_class_select(classes);
 			return;
-		}
-		for (i = 0; i < LENGTH(classclick); i++) {
-			if (!classclick[i].x)
-				break;
-			if (ev->x < classclick[i].x) {
-				if (ev->button == Button1) {
-					_class_select(classclick[i].cls);
-					return;
-				}
-
-				click = ClkClass;
-				goto process;
+		case SpanClass:
+			if (ev->button == Button1) {
+				_class_select(sp->cls);
+				return;
 			}
-		}
-		if (ev->x < selmon->x_class_ellipsis_r) {
+			click = ClkClass;
+			break;
+		case SpanClassR:
 			if (ev->button == Button1)
 				_class_select(_class_tail());
 			return;
-		}
-
-		if (ev->x < selmon->x_tag_ellipsis_l) {
+		case SpanTagL:
+		case SpanTagR:
 			if (ev->button == Button1) {
-				arg.t = selmon->tag_ellipsis_l;
+				arg.t = sp->t;
 				tag_view(&arg);
 			}
 			return;
-		}
-		for (i = 0; i < LENGTH(tagclick); i++) {
-			if (!tagclick[i].x)
-				break;
-			if (ev->x < tagclick[i].x) {
-				click = ClkTag;
-				arg.t = tagclick[i].tag;
-				goto process;
-			}
-		}
-		if (ev->x < selmon->x_tag_ellipsis_r) {
-			if (ev->button == Button1) {
-				arg.t = selmon->tag_ellipsis_r;
-				tag_view(&arg);
-			}
+		case SpanTag:
+			click = ClkTag;
+			arg.t = sp->t;
+			break;
+		case SpanUrgent:
+			_client_show(sp->c);
 			return;
-		}
-
-		for (i = 0; i < LENGTH(urgentclick); i++) {
-			if (!urgentclick[i].x)
-				break;
-			if (ev->x < urgentclick[i].x) {
-				_client_show(urgentclick[i].c);
-				return;
-			}
-		}
-
-		if (ev->x < selmon->x_layout) {
+		case SpanLayout:
 			click = ClkLayout;
-		} else if (ev->x < selmon->x_layout_param) {
+			break;
+		case SpanLayoutParam:
 			click = ClkLayoutParam;
-		} else if (ev->x < selmon->x_status_text) {
+			break;
+		case SpanStatus:
 			strcpy(stext, "");
 			drawbar(selmon);
 			return;
-		} else {
+		case SpanModules:
+			return;
+		case SpanClientL:
 			click = ClkClientList;
-
-			if (ev->x < m->x_client_ellipsis_l) {
-				arg.i = 1;
-				goto process;
-			}
-			for (i = 0; i < LENGTH(clientclick); i++) {
-				if (!clientclick[i].x)
-					break;
-				if (ev->x < clientclick[i].x) {
-					switch (ev->button) {
-					case Button1:
-						focus(clientclick[i].c);
-						restack(selmon);
-						return;
-					case Button3:
-						focus(clientclick[i].c);
-						zoom(NULL);
-						return;
-					}
-
-					goto process;
-				}
-			}
-			if (ev->x <= m->x_client_ellipsis_r) {
-				arg.i = -1;
-				goto process;
+			arg.i = 1;
+			break;
+		case SpanClient:
+			switch (ev->button) {
+			case Button1:
+				focus(sp->c);
+				restack(selmon);
+				return;
+			case Button3:
+				focus(sp->c);
+				zoom(NULL);
+				return;
 			}
+			click = ClkClientList;
+			break;
+		case SpanClientR:
+			click = ClkClientList;
+			arg.i = -1;
+			break;
+		case SpanGap: /* a separator or the version, like the root */
+			break;
+		default: /* right of the last span */
+			click = ClkClientList;
+			break;
 		}
 	} else if ((c = wintoclient(ev->window))) {
 		focus(c);
@@ -871,7 +1318,6 @@ buttonpress(XEvent *e)
 		click = ClkClientWin;
 	}
 
- process:
 	for (i = 0; i < LENGTH(buttons); i++)
 		if (click == buttons[i].click && buttons[i].func && buttons[i].button == ev->button
 			&& CLEANMASK(buttons[i].mask) == CLEANMASK(ev->state))
@@ -884,9 +1330,9 @@ checkotherwm(void)
 	xerrorxlib = XSetErrorHandler(xerrorstart);
 	/* this causes an error if some other window manager is running */
 	XSelectInput(dpy, DefaultRootWindow(dpy), SubstructureRedirectMask);
-	XSync(dpy, False);
+	xsync();
 	XSetErrorHandler(xerror);
-	XSync(dpy, False);
+	xsync();
 }
 
 void
@@ -901,10 +1347,10 @@ class_adjacent(const Arg *arg)
 		if (!cls)
 			cls = classes;
 	} else {
-		for (cls = classes; cls && cls->next != selmon->curcls; cls = cls->next);
-		if (!cls)
-			for (cls = selmon->curcls->next; cls && cls->next; cls = cls->next);
+		cls = selmon->curcls->prev;
 		if (!cls)
+			cls = classtail;
+		if (cls == selmon->curcls)
 			return;
 	}
 
@@ -945,17 +1391,13 @@ class_stack(const Arg *arg)
 			return;
 
 		_class_detach(cls);
-		cls->next = classes;
-		classes = cls;
+		_class_attach(cls, classes);
 	} else {
-		Class *tail = cls->next;
-		for (; tail && tail->next; tail = tail->next);
-		if (!tail)
+		if (cls == classtail)
 			return;
 
 		_class_detach(cls);
-		tail->next = cls;
-		cls->next = NULL;
+		_class_attach(cls, NULL);
 	}
 
 	drawbar(selmon);
@@ -974,19 +1416,14 @@ class_swap(const Arg *arg)
 			return;
 
 		_class_detach(cls);
-		cls->next = swap->next;
-		swap->next = cls;
+		_class_attach(cls, swap->next);
 	} else {
-		Class *swap = classes;
-		if (cls == swap)
-			return;
-		for (; swap && swap->next != cls; swap = swap->next);
+		Class *swap = cls->prev;
 		if (!swap)
 			return;
 
 		_class_detach(swap);
-		swap->next = cls->next;
-		cls->next = swap;
+		_class_attach(swap, cls->next);
 	}
 
 	drawbar(selmon);
@@ -1011,12 +1448,46 @@ cleanup(void)
 		drw_scm_free(drw, scheme[i], 3);
 	free(scheme);
 	XDestroyWindow(dpy, wmcheckwin);
+	cleanupipc();
+	cleanupshm();
 	drw_free(drw);
-	XSync(dpy, False);
+	free(wintab);
+	free(plans);
+	fprintf(stderr, "dwm: arrange %lu/%lu, restack %lu/%lu, drawbar %lu/%lu, status %lu/%lu, export %lu/%lu (run/requested)\n",
+		dirtyrun[DirtyArrange], dirtyreq[DirtyArrange],
+		dirtyrun[DirtyRestack], dirtyreq[DirtyRestack],
+		dirtyrun[DirtyBar], dirtyreq[DirtyBar],
+		dirtyrun[DirtyStatus], dirtyreq[DirtyStatus],
+		dirtyrun[DirtyExport], dirtyreq[DirtyExport]);
+	fprintf(stderr, "dwm: focus marked %lu bars of %lu, %lu for a monitor change\n",
+		focusbars, focusbarsall, focusmoves);
+	fprintf(stderr, "dwm: restack skipped %lu times, stacking unchanged\n", restackskip);
+#ifdef AUDIT
+	auditreport();
+#endif /* AUDIT */
+	xsync();
 	XSetInputFocus(dpy, PointerRoot, RevertToPointerRoot, CurrentTime);
 	XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
 }
 
+void
+cleanupipc(void)
+{
+	for (int i = FdIpc; i < LENGTH(fds); i++)
+		if (fds[i] >= 0)
+			close(fds[i]);
+	close(epfd);
+	if (fds[FdIpc] >= 0)
+		unlink(ipcpath);
+	if (fds[FdStatus] >= 0)
+		unlink(statuspath);
+	free(statusin);
+	for (int i = 0; i < LENGTH(mstate); i++)
+		for (int j = 0; j < LENGTH(mstate[i].fd); j++)
+			if (mstate[i].fd[j] >= 0)
+				close(mstate[i].fd[j]);
+}
+
 void
 cleanupmon(Monitor *mon)
 {
@@ -1028,11 +1499,27 @@ cleanupmon(Monitor *mon)
 		for (m = mons; m && m->next != mon; m = m->next);
 		m->next = mon->next;
 	}
+	_wintab_del(mon->barwin);
 	XUnmapWindow(dpy, mon->barwin);
 	XDestroyWindow(dpy, mon->barwin);
+	drw_buf_free(drw, mon->barbuf);
+	if (barselmon == mon)
+		barselmon = NULL;
+	free(mon->spans);
+	free(mon->stackwins);
 	free(mon);
 }
 
+void
+cleanupshm(void)
+{
+	if (!shm)
+		return;
+	munmap(shm, sizeof *shm);
+	unlink(shmpath);
+	shm = NULL;
+}
+
 void
 clear_status_text(const Arg *arg)
 {
@@ -1068,6 +1555,7 @@ client_remove_tags(const Arg *arg)
 		return;
 
 	selmon->sel->tags = 0;
+	lpgen++;
 	if (selmon->curtags) {
 		focus(NULL);
 		arrange(selmon);
@@ -1230,7 +1718,6 @@ configurenotify(XEvent *e)
 		sw = ev->width;
 		sh = ev->height;
 		if (updategeom() || dirty) {
-			drw_resize(drw, sw, bh);
 			updatebars();
 			for (m = mons; m; m = m->next) {
 				for (c = m->clients; c; c = c->next)
@@ -1251,13 +1738,17 @@ configurerequest(XEvent *e)
 	Monitor *m;
 	XConfigureRequestEvent *ev = &e->xconfigurerequest;
 	XWindowChanges wc;
+	ulong r0 = NextRequest(dpy);
 
 	if ((c = wintoclient(ev->window))) {
 		const Layout *lt = _current_layout(selmon);
 
-		if (ev->value_mask & CWBorderWidth)
+		if (ev->value_mask & CWBorderWidth) {
 			c->bw = ev->border_width;
-		else if (c->isfloating || !lt || !lt->arrange) {
+			/* the layout sends it along with the new geometry */
+			if (!c->isfloating && lt && lt->arrange && ISVISIBLE(c))
+				arrange(c->mon);
+		} else if (c->isfloating || !lt || !lt->arrange) {
 			m = c->mon;
 			if (ev->value_mask & CWX) {
 				c->oldx = c->x;
@@ -1285,6 +1776,7 @@ configurerequest(XEvent *e)
 				XMoveResizeWindow(dpy, c->win, c->x, c->y, c->w, c->h);
 		} else
 			configure(c);
+		_req_batch(c, r0);
 	} else {
 		wc.x = ev->x;
 		wc.y = ev->y;
@@ -1294,8 +1786,9 @@ configurerequest(XEvent *e)
 		wc.sibling = ev->above;
 		wc.stack_mode = ev->detail;
 		XConfigureWindow(dpy, ev->window, ev->value_mask, &wc);
+		/* the values are the client's own, so are its mistakes */
+		_req_batch(NULL, r0);
 	}
-	XSync(dpy, False);
 }
 
 Monitor *
@@ -1304,6 +1797,7 @@ createmon(void)
 	Monitor *m;
 
 	m = ecalloc(1, sizeof(Monitor));
+	m->spans = ecalloc(BAR_SPANS_MAX, sizeof(BarSpan));
 	strncpy(m->ltsymbol, layouts[0].symbol, sizeof m->ltsymbol);
 	m->topbar = TOPBAR;
 	m->showbar = SHOWBAR;
@@ -1318,7 +1812,7 @@ destroynotify(XEvent *e)
 	XDestroyWindowEvent *ev = &e->xdestroywindow;
 
 	if ((c = wintoclient(ev->window)))
-		unmanage(c, 1);
+		MEASURE(MetUnmanage, c->win, unmanage(c, 1));
 }
 
 void
@@ -1329,6 +1823,7 @@ detach(Client *c)
 
 	for (tc = &m->clients; *tc && *tc != c; tc = &(*tc)->next);
 	*tc = c->next;
+	lpgen++;
 }
 
 void
@@ -1364,54 +1859,232 @@ dirtomon(int dir)
 void
 drawbar(Monitor *m)
 {
-	if (!m || !m->showbar)
-		return;
-
-	LayoutParams *p = _layout_params(m);
-	int x, w, i;
-	int cls_idx = -1, c_idx = -1;
-	uint boxs = drw->fonts->h / 9;
-	uint boxw = drw->fonts->h / 6 + 2;
-	Class *cls;
-	Client *c;
-	tag_t occ = 0;
-	uint urg = 0;
-	char buf[20];
-
-	classclick[0].x = 0;
-	tagclick[0].x = 0;
-	urgentclick[0].x = 0;
-	clientclick[0].x = 0;
+	if (m)
+		setdirty(m, 1 << DirtyBar);
+}
 
-	m->x_class_ellipsis_l = m->x_class_ellipsis_r = 0;
-	m->x_tag_ellipsis_l = m->x_tag_ellipsis_r = 0;
-	m->tag_ellipsis_l = m->tag_ellipsis_r = 0;
-	m->x_client_ellipsis_l = m->x_client_ellipsis_r = 0;
-	m->x_layout = m->x_layout_param = 0;
+void
+_bar_replay(void)
+{
+	Clr *scm = drw->scheme;
+	BarOp *op;
 
-	for (i = 0, cls = classes; cls; cls = cls->next, i++) {
-		if (cls == m->curcls)
-			cls_idx = i;
+	for (op = barops; op < barops + nbarops; op++) {
+		drw_setscheme(drw, op->scm);
+		if (op->text)
+			drw_text(drw, op->x, op->y, op->w, op->h, op->arg, op->text, op->invert);
+		else
+			drw_rect(drw, op->x, op->y, op->w, op->h, op->arg, op->invert);
 	}
-	const int cls_cnt = i;
+	drw_setscheme(drw, scm);
+	nbarops = 0;
+}
 
-	for (i = 0, c = m->clients; c; c = c->next) {
-		if (ISVISIBLE(c)) {
-			if (c == m->sel)
-				c_idx = i;
-			i++;
-		}
+/* Records a drawing operation of the current segment and folds it into the
+ * segment fingerprint; text must stay valid until the segment ends. */
+void
+_bar_op(const char *text, int x, int y, uint w, uint h, int arg, int invert)
+{
+	BarOp *op;
+	int v[] = { text != NULL, x, y, w, h, arg, invert };
 
-		occ |= c->tags;
-		if (urg < BAR_URGENT_MAX && c->isurgent) {
-			urgentclick[urg].c = c;
-			urg++;
-		}
+	if (nbarops == LENGTH(barops)) {
+		/* out of room, draw now and treat the segment as changed */
+		_bar_replay();
+		barforce = 1;
 	}
-	const int c_cnt = i;
-
-	x = 0;
+	op = &barops[nbarops++];
+	op->scm = drw->scheme;
+	op->text = text;
+	op->x = x;
+	op->y = y;
+	op->w = w;
+	op->h = h;
+	op->arg = arg;
+	op->invert = invert;
+
+	barhash = _fnv1a(barhash, v, sizeof v);
+	barhash = _fnv1a(barhash, &op->scm, sizeof op->scm);
+	if (text)
+		barhash = _fnv1a(barhash, text, strlen(text));
+}
 
+void
+_bar_text(int x, int y, uint w, uint h, uint lpad, const char *text, int invert)
+{
+	_bar_op(text, x, y, w, h, lpad, invert);
+}
+
+void
+_bar_rect(int x, int y, uint w, uint h, int filled, int invert)
+{
+	_bar_op(NULL, x, y, w, h, filled, invert);
+}
+
+void
+_bar_seg_begin(int x)
+{
+	nbarops = barforce = 0;
+	barhash = 0xcbf29ce484222325ULL;
+	barx0 = x;
+}
+
+/* Draws the segment only if its content or x-range changed since the last
+ * drawbar() and remembers the range to copy to the bar window. */
+void
+_bar_seg_end(Monitor *m, int seg, int x1)
+{
+	BarSeg *sg = &m->segs[seg];
+
+	bardone |= 1 << seg;
+	if (!barhash)
+		barhash = 1;
+	if (!barforce && sg->hash == barhash && sg->x0 == barx0 && sg->x1 == x1) {
+		nbarops = 0;
+		return;
+	}
+
+	_bar_replay();
+	sg->hash = barhash;
+	sg->x0 = barx0;
+	sg->x1 = x1;
+
+	if (nbardmg && bardmg[nbardmg - 1][1] == barx0) {
+		bardmg[nbardmg - 1][1] = x1;
+	} else {
+		bardmg[nbardmg][0] = barx0;
+		bardmg[nbardmg][1] = x1;
+		nbardmg++;
+	}
+}
+
+BarSpan *
+_bar_span(Monitor *m, uint type, int x)
+{
+	BarSpan *sp;
+
+	if (m->nspans < BAR_SPANS_MAX)
+		m->nspans++;
+	sp = &m->spans[m->nspans - 1];
+	sp->x = x;
+	/* out of room, the last span covers the rest of the bar as a gap */
+	sp->type = m->nspans < BAR_SPANS_MAX ? type : SpanGap;
+	sp->cls = NULL;
+	sp->c = NULL;
+	sp->t = 0;
+	return sp;
+}
+
+/* Returns the span containing x, spans are sorted by their right edge. */
+BarSpan *
+_bar_span_at(Monitor *m, int x)
+{
+	int lo = 0, hi = m->nspans, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (x < m->spans[mid].x)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+	return lo < m->nspans ? &m->spans[lo] : NULL;
+}
+
+/* Copies the parts of the bar drawn since nbardmg was reset to its window. */
+void
+_bar_map(Monitor *m)
+{
+	for (int i = 0; i < nbardmg; i++)
+		if (bardmg[i][0] < m->ww) {
+			drw_map(drw, m->barwin, bardmg[i][0], 0,
+				MIN(bardmg[i][1], m->ww) - bardmg[i][0], bh);
+		}
+}
+
+/* Records the status text and the modules from x on, returns their end. */
+int
+_bar_status(Monitor *m, int x)
+{
+	int i, w;
+
+	if (strlen(stext)) {
+		w = TEXTW(stext);
+		if (w > BAR_STATUS_WIDTH)
+			w = BAR_STATUS_WIDTH;
+
+		drw_setscheme(drw, scheme[SchemeStatus]);
+		_bar_text(x, 0, w, bh, lrpad_2, stext, 1);
+
+		x += w;
+		_bar_span(m, SpanStatus, x);
+
+		_bar_rect(x, 0, 1, bh, 0, 1);
+		x += 1;
+		_bar_span(m, SpanGap, x);
+	}
+	for (i = 0; i < LENGTH(mstate); i++) {
+		if (!mstate[i].text[0])
+			continue;
+		w = TEXTW(mstate[i].text);
+		drw_setscheme(drw, scheme[SchemeStatus]);
+		_bar_text(x, 0, w, bh, lrpad_2, mstate[i].text, 0);
+		x += w;
+		_bar_span(m, SpanModules, x);
+		_bar_rect(x, 0, 1, bh, 0, 1);
+		x += 1;
+		_bar_span(m, SpanGap, x);
+	}
+	return x;
+}
+
+void
+_drawbar(Monitor *m)
+{
+	if (!m->showbar)
+		return;
+
+	dirtyrun[DirtyBar]++;
+	drw_setbuf(drw, m->barbuf);
+
+	LayoutParams *p = _layout_params(m);
+	int x, w, i;
+	int cls_idx = -1, c_idx = -1;
+	uint boxs = drw->fonts->h / 9;
+	uint boxw = drw->fonts->h / 6 + 2;
+	Class *cls;
+	Client *c;
+	tag_t occ = 0;
+	Client *urgc[BAR_URGENT_MAX];
+	uint urg = 0;
+	char nbuf[12], fbuf[12];
+
+	m->nspans = 0;
+
+	_class_renumber();
+	if (m->curcls)
+		cls_idx = m->curcls->idx;
+	const int cls_cnt = nclasses;
+
+	for (i = 0, c = m->clients; c; c = c->next) {
+		if (ISVISIBLE(c)) {
+			if (c == m->sel)
+				c_idx = i;
+			i++;
+		}
+
+		occ |= c->tags;
+		if (urg < BAR_URGENT_MAX && c->isurgent) {
+			urgc[urg++] = c;
+		}
+	}
+	const int c_cnt = i;
+
+	x = 0;
+	bardone = 0;
+	nbardmg = 0;
+
+	_bar_seg_begin(x);
 	if (cls_cnt > 0) {
 		int start = 0;
 		int end = cls_cnt;
@@ -1433,49 +2106,46 @@ drawbar(Monitor *m)
 				cls = cls->next;
 
 			drw_setscheme(drw, scheme[SchemeNormal]);
-			drw_text(drw, x, 0, w_ellipsis_l, bh, lrpad_2, ellipsis_l, 0);
+			_bar_text(x, 0, w_ellipsis_l, bh, lrpad_2, ellipsis_l, 0);
 
 			x += w_ellipsis_l;
-			m->x_class_ellipsis_l = x;
+			_bar_span(m, SpanClassL, x);
 		}
 
 		drw_setscheme(drw, scheme[SchemeClass]);
-		int bar_i = 0;
-		for (i = 0; cls && i < BAR_CLASS_MAX; cls = cls->next, i++, bar_i++) {
+		for (i = 0; cls && i < BAR_CLASS_MAX; cls = cls->next, i++) {
 			int invert = !m->curtags && cls == m->curcls;
-			drw_text(drw, x, 0, cls->w_name, bh, lrpad_2, cls->name, invert);
+			_bar_text(x, 0, cls->w_name, bh, lrpad_2, cls->name, invert);
 			if (m->sel && m->sel->class == cls)
-				drw_rect(drw, x + boxs, boxs, boxw, boxw, 1, invert);
+				_bar_rect(x + boxs, boxs, boxw, boxw, 1, invert);
 			x += cls->w_name;
-
-			classclick[bar_i].x = x;
-			classclick[bar_i].cls = cls;
-		}
-		if (bar_i < BAR_CLASS_MAX) {
-			classclick[bar_i].x = 0;
-			classclick[bar_i].cls = NULL;
+			_bar_span(m, SpanClass, x)->cls = cls;
 		}
 
 		if (end < cls_cnt) {
 			drw_setscheme(drw, scheme[SchemeNormal]);
-			drw_text(drw, x, 0, w_ellipsis_r, bh, lrpad_2, ellipsis_r, 0);
+			_bar_text(x, 0, w_ellipsis_r, bh, lrpad_2, ellipsis_r, 0);
 
 			x += w_ellipsis_r;
-			m->x_class_ellipsis_r = x;
+			_bar_span(m, SpanClassR, x);
 		}
 	} else {
 		drw_setscheme(drw, scheme[SchemeNormal]);
-		drw_text(drw, x, 0, w_dwm_version, bh, lrpad_2, dwm_version, 0);
+		_bar_text(x, 0, w_dwm_version, bh, lrpad_2, dwm_version, 0);
 		x += w_dwm_version;
+		_bar_span(m, SpanGap, x);
 	}
+	_bar_seg_end(m, SegClass, x);
 	if (x > m->mw) goto draw;
 
+	_bar_seg_begin(x);
 	tag_t t = m->curtags ? m->curtags | occ : occ;
 	const int tag_cnt = t == 0 ? 0 : (int)log2(t) + 1;
 	if (t) {
 		drw_setscheme(drw, scheme[SchemeNormal]);
-		drw_rect(drw, x, 0, 2, bh, 0, 1);
+		_bar_rect(x, 0, 2, bh, 0, 1);
 		x += 2;
+		_bar_span(m, SpanGap, x);
 
 		int tag_idx = m->curtags == 0 ? 0 : (int)log2(m->curtags & -m->curtags);
 
@@ -1495,16 +2165,13 @@ drawbar(Monitor *m)
 
 		if (start) {
 			drw_setscheme(drw, scheme[SchemeNormal]);
-			drw_text(drw, x, 0, w_ellipsis_l, bh, lrpad_2, ellipsis_l, 0);
+			_bar_text(x, 0, w_ellipsis_l, bh, lrpad_2, ellipsis_l, 0);
 			x += w_ellipsis_l;
-
-			m->x_tag_ellipsis_l = x;
-			m->tag_ellipsis_l = TAG_UNIT;
+			_bar_span(m, SpanTagL, x)->t = TAG_UNIT;
 		}
 
 		tag_t t = TAG_UNIT << start;
-		int bar_i = 0;
-		for (i = start; i < end; i++, t <<= 1, bar_i++) {
+		for (i = start; i < end; i++, t <<= 1) {
 			int is_selected = m->curtags && t & m->curtags;
 			int s_idx = t & occ || is_selected ? SchemeTag : SchemeNormal;
 			int invert = is_selected;
@@ -1512,89 +2179,82 @@ drawbar(Monitor *m)
 			drw_setscheme(drw, scheme[s_idx]);
 
 			int w2 = w_tlabels[i];
-			drw_text(drw, x, 0, w2, bh, lrpad_2, tlabels[i], invert);
+			_bar_text(x, 0, w2, bh, lrpad_2, tlabels[i], invert);
 
 			if (draw_box)
-				drw_rect(drw, x + boxs, boxs, boxw, boxw, 1, invert);
+				_bar_rect(x + boxs, boxs, boxw, boxw, 1, invert);
 
 			x += w2;
-			tagclick[bar_i].x = x;
-			tagclick[bar_i].tag = t;
-		}
-		if (bar_i < BAR_TAG_MAX) {
-			tagclick[bar_i].x = 0;
-			tagclick[bar_i].tag = 0;
+			_bar_span(m, SpanTag, x)->t = t;
 		}
 
 		if (end < tag_cnt) {
 			drw_setscheme(drw, scheme[SchemeNormal]);
-			drw_text(drw, x, 0, w_ellipsis_r, bh, lrpad_2, ellipsis_r, 0);
+			_bar_text(x, 0, w_ellipsis_r, bh, lrpad_2, ellipsis_r, 0);
 
 			x += w_ellipsis_r;
 
-			m->x_tag_ellipsis_r = x;
 			int msb = occ == 0 ? 0 : (int)log2(occ);
-			m->tag_ellipsis_r = TAG_UNIT << msb;
+			_bar_span(m, SpanTagR, x)->t = TAG_UNIT << msb;
 		}
 	}
+	_bar_seg_end(m, SegTag, x);
 	if (x > m->mw) goto draw;
 
+	_bar_seg_begin(x);
 	if (urg) {
 		drw_setscheme(drw, scheme[SchemeUrgent]);
-		drw_rect(drw, x, 0, 1, bh, 0, 1);
+		_bar_rect(x, 0, 1, bh, 0, 1);
 		x += 1;
+		_bar_span(m, SpanGap, x);
 
 		for (i = 0; i < urg; i++) {
-			c = urgentclick[i].c;
+			c = urgc[i];
 
 			w = TEXTW(c->name);
 			if (w > BAR_URGENT_WIDTH)
 				w = BAR_URGENT_WIDTH;
-			drw_text(drw, x, 0, w, bh, lrpad_2, c->name, 1);
+			_bar_text(x, 0, w, bh, lrpad_2, c->name, 1);
 
 			x += w;
-			urgentclick[i].x = x;
+			_bar_span(m, SpanUrgent, x)->c = c;
 		}
 	}
+	_bar_seg_end(m, SegUrgent, x);
 	if (x > m->mw) goto draw;
 
+	_bar_seg_begin(x);
 	if (p) {
 		w = TEXTW(m->ltsymbol);
 		drw_setscheme(drw, scheme[SchemeLayout]);
-		drw_text(drw, x, 0, w, bh, lrpad_2, m->ltsymbol, 0);
+		_bar_text(x, 0, w, bh, lrpad_2, m->ltsymbol, 0);
 		x += w;
-		m->x_layout = x;
+		_bar_span(m, SpanLayout, x);
 
-		snprintf(buf, sizeof(buf), "%d", p->nmaster);
-		w = TEXTW(buf);
+		snprintf(nbuf, sizeof(nbuf), "%d", p->nmaster);
+		w = TEXTW(nbuf);
 		drw_setscheme(drw, scheme[SchemeNmaster]);
-		drw_text(drw, x, 0, w, bh, lrpad_2, buf, 0);
+		_bar_text(x, 0, w, bh, lrpad_2, nbuf, 0);
 		x += w;
 
-		snprintf(buf, sizeof(buf), "%0.2f", p->mfact);
-		w = TEXTW(buf);
+		snprintf(fbuf, sizeof(fbuf), "%0.2f", p->mfact);
+		w = TEXTW(fbuf);
 		drw_setscheme(drw, scheme[SchemeMfact]);
-		drw_text(drw, x, 0, w, bh, lrpad_2, buf, 0);
+		_bar_text(x, 0, w, bh, lrpad_2, fbuf, 0);
 		x += w;
-		m->x_layout_param = x;
+		_bar_span(m, SpanLayoutParam, x);
 	}
+	_bar_seg_end(m, SegLayout, x);
 	if (x > m->mw) goto draw;
 
-	if (strlen(stext)) {
-		w = TEXTW(stext);
-		if (w > BAR_STATUS_WIDTH)
-			w = BAR_STATUS_WIDTH;
-
-		drw_setscheme(drw, scheme[SchemeStatus]);
-		drw_text(drw, x, 0, w, bh, lrpad_2, stext, 1);
-
-		x += w;
-		m->x_status_text = x;
-
-		drw_rect(drw, x, 0, 1, bh, 0, 1);
-		x += 1;
-	}
+	_bar_seg_begin(x);
+	m->statusspan = m->nspans;
+	if (m == selmon)
+		x = _bar_status(m, x);
+	m->statusspans = m->nspans - m->statusspan;
+	_bar_seg_end(m, SegStatus, x);
 
+	_bar_seg_begin(x);
 	const int w_rest_area = m->mw - x;
 	if (w_rest_area > 100 && c_cnt > 0) {
 		const int s_idx = m->curtags ? SchemeTag : SchemeClass;
@@ -1628,24 +2288,20 @@ drawbar(Monitor *m)
 					if (ISVISIBLE(c))
 						i++;
 
-				drw_text(drw, x, 0, w_ellipsis_l, bh, lrpad_2, ellipsis_l, 0);
+				_bar_text(x, 0, w_ellipsis_l, bh, lrpad_2, ellipsis_l, 0);
 				x += w_ellipsis_l;
 				w2 -= w_ellipsis_l;
-
-				m->x_client_ellipsis_l = x;
+				_bar_span(m, SpanClientL, x);
 			}
 			if (end < c_cnt) {
-				drw_text(drw, m->mw - w_ellipsis_r, 0, w_ellipsis_r, bh, lrpad_2, ellipsis_r, 0);
+				_bar_text(m->mw - w_ellipsis_r, 0, w_ellipsis_r, bh, lrpad_2, ellipsis_r, 0);
 				end_x -= w_ellipsis_r;
 				w2 -= w_ellipsis_r;
-
-				m->x_client_ellipsis_r = m->mw;
 			}
 
 			w = w2 / (end - start);
 		}
 
-		int bar_i = 0;
 		for (; c && i < end; c = c->next) {
 			if (!ISVISIBLE(c))
 				continue;
@@ -1657,7 +2313,7 @@ drawbar(Monitor *m)
 			if (i < LENGTH(clabels)) {
 				int w3 = w_clabels[i];
 				drw_setscheme(drw, scheme[is_sel ? s_idx : SchemeClntLbl]);
-				drw_text(drw, x, 0, w3, bh, lrpad_2, clabels[i],
+				_bar_text(x, 0, w3, bh, lrpad_2, clabels[i],
 						 is_selmon || c->isurgent);
 
 				w2 -= w3;
@@ -1665,37 +2321,72 @@ drawbar(Monitor *m)
 			}
 
 			drw_setscheme(drw, scheme[is_sel ? s_idx : SchemeNormal]);
-			drw_text(drw, x, 0, w2, bh, lrpad_2, c->name, 0);
+			_bar_text(x, 0, w2, bh, lrpad_2, c->name, 0);
 
 			if (c->isfloating)
-				drw_rect(drw, x + boxs, boxs, boxw, boxw, c->isfixed, 0);
+				_bar_rect(x + boxs, boxs, boxw, boxw, c->isfixed, 0);
 
 			x += w2;
-
-			clientclick[bar_i].x = x;
-			clientclick[bar_i].c = c;
+			_bar_span(m, SpanClient, x)->c = c;
 			i++;
-			bar_i++;
-		}
-		if (bar_i < BAR_CLIENT_MAX) {
-			clientclick[bar_i].x = 0;
-			clientclick[bar_i].c = NULL;
 		}
 
 		if (x < end_x) {
 			drw_setscheme(drw, scheme[SchemeNormal]);
-			drw_rect(drw, x, 0, end_x - x, bh, 1, 1);
+			_bar_rect(x, 0, end_x - x, bh, 1, 1);
+			/* empty, as if right of the last span */
+			_bar_span(m, SpanLast, end_x);
 		}
+		if (end_x < m->mw)
+			_bar_span(m, SpanClientR, m->mw + 1);
 		x = m->mw;
 	}
 
 	if (x < m->mw) {
 		drw_setscheme(drw, scheme[SchemeNormal]);
-		drw_rect(drw, x, 0, m->mw - x, bh, 1, 1);
+		_bar_rect(x, 0, m->mw - x, bh, 1, 1);
 	}
 
+	_bar_seg_end(m, SegClient, m->mw);
+
  draw:
-	drw_map(drw, m->barwin, 0, 0, m->ww, bh);
+	/* segments not reached have to be drawn when they are reached again */
+	for (i = 0; i < SegLast; i++)
+		if (!(bardone & 1 << i))
+			m->segs[i].hash = 0;
+	_bar_map(m);
+}
+
+/* Repaints the status segment in place. A status of another width or
+ * with other spans moves what follows it, so that takes the whole bar. */
+void
+_drawstatus(Monitor *m)
+{
+	BarSeg *sg = &m->segs[SegStatus];
+	int n = m->nspans, x1;
+
+	if (!m->showbar)
+		return;
+	if (!sg->hash) {
+		_drawbar(m);
+		return;
+	}
+
+	dirtyrun[DirtyStatus]++;
+	drw_setbuf(drw, m->barbuf);
+	m->nspans = m->statusspan;
+	_bar_seg_begin(sg->x0);
+	x1 = _bar_status(m, sg->x0);
+	if (x1 != sg->x1 || m->nspans - m->statusspan != m->statusspans) {
+		nbarops = 0;
+		m->nspans = n;
+		_drawbar(m);
+		return;
+	}
+	m->nspans = n;
+	nbardmg = 0;
+	_bar_seg_end(m, SegStatus, x1);
+	_bar_map(m);
 }
 
 void
@@ -1707,6 +2398,48 @@ drawbars(void)
 		drawbar(m);
 }
 
+/* Performs the arrange, restack and bar work requested since the last call,
+ * at most once per monitor. Called after each batch of X events. */
+void
+flushdirty(void)
+{
+	Monitor *m;
+	uint dirty, all = 0;
+	struct timespec now;
+
+	for (m = mons; m; m = m->next)
+		if (m->dirty & 1 << DirtyArrange)
+			showhide(m->stack);
+	for (m = mons; m; m = m->next)
+		if (m->dirty & 1 << DirtyArrange) {
+			MEASURE(MetArrange, m->num, arrangemon(m));
+			dirtyrun[DirtyArrange]++;
+		}
+	for (m = mons; m; m = m->next) {
+		dirty = m->dirty;
+		m->dirty = 0;
+		all |= dirty & ~(1 << DirtyStatus); /* not exported */
+		if (dirty & 1 << DirtyRestack)
+			MEASURE(MetRestack, m->num, _restack(m));
+		if (dirty & 1 << DirtyBar)
+			MEASURE(MetDrawbar, m->num, _drawbar(m));
+		else if (dirty & 1 << DirtyStatus)
+			MEASURE(MetDrawbar, m->num, _drawstatus(m));
+	}
+	if (all) {
+		dirtyrun[DirtyExport]++;
+		publishstate();
+		ipcdiff();
+	}
+	if (reloadts.tv_sec && dirtyrun[DirtyBar]) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		fprintf(stderr, "dwm: reload to first paint in %ld us\n",
+			(now.tv_sec - reloadts.tv_sec) * 1000000
+			+ (now.tv_nsec - reloadts.tv_nsec) / 1000);
+		reloadts.tv_sec = 0;
+	}
+}
+
 void
 group_adjacent(const Arg *arg)
 {
@@ -1811,6 +2544,8 @@ enternotify(XEvent *e)
 
 	if ((ev->mode != NotifyNormal || ev->detail == NotifyInferior) && ev->window != root)
 		return;
+	if (ev->serial <= enterserial)
+		return;
 	c = wintoclient(ev->window);
 	m = c ? c->mon : wintomon(ev->window);
 	if (m != selmon) {
@@ -1827,13 +2562,17 @@ expose(XEvent *e)
 	Monitor *m;
 	XExposeEvent *ev = &e->xexpose;
 
-	if (ev->count == 0 && (m = wintomon(ev->window)))
+	if (ev->count == 0 && (m = wintomon(ev->window))) {
+		memset(m->segs, 0, sizeof(m->segs));
 		drawbar(m);
+	}
 }
 
 void
 focus(Client *c)
 {
+	Monitor *m;
+
 	if (!c || !ISVISIBLE(c)) {
 		for (c = selmon->stack; c && !ISVISIBLE(c); c = c->snext);
 	}
@@ -1841,7 +2580,7 @@ focus(Client *c)
 	if (selmon->sel && selmon->sel != c)
 		unfocus(selmon->sel, 0);
 	if (c) {
-		Monitor *m = c->mon;
+		m = c->mon;
 		if (m != selmon)
 			selmon = m;
 		if (c->isurgent)
@@ -1856,7 +2595,22 @@ focus(Client *c)
 		XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
 	}
 	selmon->sel = c;
-	drawbars();
+
+	/* only the selection and the selmon marker can have moved; callers
+	 * switching monitors set selmon before, so compare with the bar that
+	 * was last marked as selected */
+	drawbar(selmon);
+	focusbars++;
+	if (barselmon != selmon) {
+		if (barselmon) {
+			drawbar(barselmon);
+			focusbars++;
+			focusmoves++;
+		}
+		barselmon = selmon;
+	}
+	for (m = mons; m; m = m->next)
+		focusbarsall++;
 }
 
 /* there are some broken focus acquiring clients needing extra handling */
@@ -1936,24 +2690,6 @@ getrootptr(int *x, int *y)
 	return XQueryPointer(dpy, root, &dummy, &dummy, x, y, &di, &di, &dui);
 }
 
-long
-getstate(Window w)
-{
-	int format;
-	long result = -1;
-	unsigned char *p = NULL;
-	unsigned long n, extra;
-	Atom real;
-
-	if (XGetWindowProperty(dpy, w, wmatom[WMState], 0L, 2L, False, wmatom[WMState],
-		&real, &format, &n, &extra, (unsigned char **)&p) != Success)
-		return -1;
-	if (n != 0)
-		result = *p;
-	XFree(p);
-	return result;
-}
-
 int
 gettextprop(Window w, Atom atom, char *text, uint size)
 {
@@ -2037,6 +2773,150 @@ incnmaster(const Arg *arg)
 	arrange(selmon);
 }
 
+void
+ipcaccept(void)
+{
+	int fd, i;
+
+	if ((fd = accept(fds[FdIpc], NULL, NULL)) < 0)
+		return;
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	fcntl(fd, F_SETFL, O_NONBLOCK);
+	for (i = FdClients; i < LENGTH(fds) && fds[i] >= 0; i++);
+	if (i == LENGTH(fds)) {
+		close(fd);
+		return;
+	}
+	watchfd(i, fd, EPOLLIN);
+}
+
+/* Sends focus and view changes of the last batch to subscribers. */
+void
+ipcdiff(void)
+{
+	Monitor *m;
+
+	for (m = mons; m; m = m->next)
+		if (m->curtags != m->evtags || m->curcls != m->evcls) {
+			m->evtags = m->curtags;
+			m->evcls = m->curcls;
+			ipcevent(IpcEvView, NULL, m, m->curtags);
+		}
+	if (selmon->num != evmon || (selmon->sel ? selmon->sel->win : 0) != evwin) {
+		evmon = selmon->num;
+		evwin = selmon->sel ? selmon->sel->win : 0;
+		ipcevent(IpcEvFocus, selmon->sel, selmon, 0);
+	}
+}
+
+void
+ipcdrop(int i)
+{
+	IpcClient *cl = &ipcclients[i - FdClients];
+	int fd = fds[i];
+
+	watchfd(i, -1, 0);
+	close(fd);
+	free(cl->queue);
+	memset(cl, 0, sizeof *cl);
+}
+
+/* Queues an event for its subscribers, sent by ipcflush() before dwm
+ * waits again. A full queue drops the event. */
+void
+ipcevent(uint type, Client *c, Monitor *m, uint64_t arg)
+{
+	IpcClient *cl;
+	IpcEvent *ev;
+
+	for (cl = ipcclients; cl < ipcclients + LENGTH(ipcclients); cl++) {
+		if (!(cl->mask & 1ULL << type))
+			continue;
+		if (cl->head - cl->tail == IPC_QUEUE) {
+			cl->dropped++;
+			continue;
+		}
+		ev = &cl->queue[cl->head++ & (IPC_QUEUE - 1)];
+		memset(ev, 0, sizeof *ev);
+		ev->type = type;
+		ev->dropped = cl->dropped;
+		ev->win = c ? c->win : 0;
+		ev->mon = m->num;
+		_class_renumber();
+		if (c)
+			ev->cls = c->class->idx;
+		else
+			ev->cls = m->curtags || !m->curcls ? -1 : m->curcls->idx;
+		ev->arg = arg;
+		cl->dropped = 0;
+	}
+}
+
+void
+ipcflush(int i)
+{
+	IpcClient *cl = &ipcclients[i - FdClients];
+
+	for (; cl->tail != cl->head; cl->tail++)
+		if (send(fds[i], &cl->queue[cl->tail & (IPC_QUEUE - 1)],
+		         sizeof(IpcEvent), MSG_DONTWAIT|MSG_NOSIGNAL) < 0) {
+			if (errno != EAGAIN) {
+				ipcdrop(i);
+				return;
+			}
+			break;
+		}
+	/* wait for the socket to drain instead of spinning */
+	watchfd(i, fds[i], cl->tail != cl->head ? EPOLLIN|EPOLLOUT : EPOLLIN);
+}
+
+/* Runs one batch of commands, the deferred arrange and redraw of all of
+ * them happen together in the next flushdirty(). */
+void
+ipcmessage(int i)
+{
+	IpcCmd cmd[IPC_BATCH_MAX];
+	IpcReply rep = { IpcOk, 0 };
+	const IpcCommand *ic;
+	Arg arg;
+	ssize_t n;
+
+	if ((n = recv(fds[i], cmd, sizeof cmd, MSG_TRUNC)) <= 0) {
+		if (n == 0 || (errno != EAGAIN && errno != EINTR))
+			ipcdrop(i);
+		return;
+	}
+	if (n > sizeof cmd || n % sizeof *cmd)
+		rep.status = IpcBadSize;
+	for (n /= sizeof *cmd; !rep.status && rep.done < n && running; rep.done++) {
+		if (cmd[rep.done].op == IPC_SUBSCRIBE) {
+			ipcclients[i - FdClients].mask = cmd[rep.done].arg.t;
+			if (!ipcclients[i - FdClients].queue)
+				ipcclients[i - FdClients].queue = ecalloc(IPC_QUEUE, sizeof(IpcEvent));
+			continue;
+		}
+		if (cmd[rep.done].op >= LENGTH(ipccmds)) {
+			rep.status = IpcBadOp;
+			break;
+		}
+		ic = &ipccmds[cmd[rep.done].op];
+		memset(&arg, 0, sizeof arg);
+		switch (ic->argtype) {
+		case IpcArgInt: arg.i = cmd[rep.done].arg.i; break;
+		case IpcArgFloat: arg.f = cmd[rep.done].arg.f; break;
+		case IpcArgTag: arg.t = cmd[rep.done].arg.t; break;
+		case IpcArgShorts:
+			arg.s.s1 = cmd[rep.done].arg.s.s1;
+			arg.s.s2 = cmd[rep.done].arg.s.s2;
+			break;
+		}
+		ic->func(&arg);
+	}
+	if (send(fds[i], &rep, sizeof rep, MSG_DONTWAIT|MSG_NOSIGNAL) < 0
+	&& errno != EAGAIN)
+		ipcdrop(i);
+}
+
 #ifdef XINERAMA
 static int
 isuniquegeom(XineramaScreenInfo *unique, size_t n, XineramaScreenInfo *info)
@@ -2075,18 +2955,363 @@ killclient(const Arg *arg)
 		XSetErrorHandler(xerrordummy);
 		XSetCloseDownMode(dpy, DestroyAll);
 		XKillClient(dpy, selmon->sel->win);
-		XSync(dpy, False);
+		xsync();
 		XSetErrorHandler(xerror);
 		XUngrabServer(dpy);
 	}
 }
 
+int
+_snap_cmp(const void *a, const void *b)
+{
+	Window wa = snapc[*(const int *)a].win, wb = snapc[*(const int *)b].win;
+
+	return wa < wb ? -1 : wa > wb;
+}
+
+int
+_snap_find(const void *key, const void *b)
+{
+	Window wa = *(const Window *)key, wb = snapc[*(const int *)b].win;
+
+	return wa < wb ? -1 : wa > wb;
+}
+
+SnapClient *
+_snap_client(Window w)
+{
+	int *i;
+
+	if (!nsnapc)
+		return NULL;
+	i = bsearch(&w, snapbywin, nsnapc, sizeof *snapbywin, _snap_find);
+	return i ? &snapc[*i] : NULL;
+}
+
+Monitor *
+_snap_mon(int num)
+{
+	Monitor *m;
+
+	for (m = mons; m && m->num != num; m = m->next);
+	return m ? m : selmon;
+}
+
+void
+_runtime_path(char *path, size_t size, const char *fmt)
+{
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+	char name[64];
+
+	snprintf(name, sizeof name, "%s", DisplayString(dpy));
+	for (char *p = name; *p; p++)
+		if (*p == '/')
+			*p = '_';
+	snprintf(path, size, "%s/", dir ? dir : "/tmp");
+	snprintf(path + strlen(path), size - strlen(path), fmt, name);
+}
+
+/* Reads the snapshot left by savestate() and registers its classes and
+ * monitor views, scan() then adopts the listed windows as they were.
+ * Returns the number of listed windows, 0 without a snapshot. */
+int
+loadstate(void)
+{
+	char path[PATH_MAX];
+	FILE *f;
+	SnapHeader h;
+	SnapClass *sc = NULL;
+	SnapMon *sm = NULL;
+	SnapClient *scl = NULL;
+	Window *stack = NULL;
+	Monitor *m;
+	int fd, i, ok = 0;
+
+	_runtime_path(path, sizeof path, RELOAD_STATE);
+	if ((fd = open(path, O_RDONLY|O_NOFOLLOW)) < 0)
+		return 0;
+	unlink(path);
+	if (!(f = fdopen(fd, "r"))) {
+		close(fd);
+		return 0;
+	}
+
+	/* read and check all of it first, a bad snapshot changes nothing */
+	if (fread(&h, sizeof h, 1, f) != 1 || h.magic != SNAP_MAGIC
+	|| h.size != sizeof(SnapClient)
+	|| h.nclasses < 0 || h.nclasses > SNAP_CLASSES_MAX
+	|| h.nmons < 0 || h.nmons > SNAP_MONS_MAX
+	|| h.nclients < 0 || h.nclients > SNAP_CLIENTS_MAX)
+		goto out;
+	sc = ecalloc(h.nclasses + 1, sizeof *sc);
+	sm = ecalloc(h.nmons + 1, sizeof *sm);
+	scl = ecalloc(h.nclients + 1, sizeof *scl);
+	stack = ecalloc(h.nclients + 1, sizeof *stack);
+	if (fread(sc, sizeof *sc, h.nclasses, f) != (size_t)h.nclasses
+	|| fread(sm, sizeof *sm, h.nmons, f) != (size_t)h.nmons
+	|| fread(scl, sizeof *scl, h.nclients, f) != (size_t)h.nclients
+	|| fread(stack, sizeof *stack, h.nclients, f) != (size_t)h.nclients
+	|| fgetc(f) != EOF)
+		goto out;
+	for (i = 0; i < h.nclasses; i++) {
+		if (!memchr(sc[i].name, '\0', sizeof sc[i].name))
+			goto out;
+		if (sc[i].params.lt_idx >= LENGTH(layouts)) /* config changed */
+			sc[i].params.lt_idx = 0;
+	}
+	for (i = 0; i < h.nmons; i++)
+		if (sm[i].curcls < -1 || sm[i].curcls >= h.nclasses
+		|| sm[i].prevcls < -1 || sm[i].prevcls >= h.nclasses)
+			goto out;
+	for (i = 0; i < h.nclients; i++) {
+		if (scl[i].cls < -1 || scl[i].cls >= h.nclasses)
+			goto out;
+		if (scl[i].params.lt_idx >= LENGTH(layouts))
+			scl[i].params.lt_idx = 0;
+	}
+
+	snapcls = ecalloc(h.nclasses + 1, sizeof *snapcls);
+	for (i = 0; i < h.nclasses; i++)
+		snapcls[nsnapcls++] = _class_new(sc[i].name, &sc[i].params);
+	for (i = 0; i < h.nmons; i++) {
+		for (m = mons; m && m->num != sm[i].num; m = m->next);
+		if (!m)
+			continue;
+		m->curtags = sm[i].curtags;
+		m->prevtags = sm[i].prevtags;
+		m->curcls = sm[i].curcls >= 0 ? snapcls[sm[i].curcls] : NULL;
+		m->prevcls = sm[i].prevcls >= 0 ? snapcls[sm[i].prevcls] : NULL;
+		if (!m->curtags && !m->curcls)
+			m->curtags = TAG_UNIT;
+		if (m->showbar != sm[i].showbar) {
+			m->showbar = sm[i].showbar;
+			updatebarpos(m);
+			XMoveResizeWindow(dpy, m->barwin, m->wx, m->by, m->ww, bh);
+		}
+	}
+	snapc = scl;
+	snapstack = stack;
+	scl = NULL;
+	stack = NULL;
+	snapbywin = ecalloc(h.nclients + 1, sizeof *snapbywin);
+	for (i = 0; i < h.nclients; i++)
+		snapbywin[i] = i;
+	nsnapc = h.nclients;
+	qsort(snapbywin, nsnapc, sizeof *snapbywin, _snap_cmp);
+	for (m = mons; m && m->num != h.selmon; m = m->next);
+	if (m)
+		selmon = m;
+	reloadts = h.reloadts;
+	ok = 1;
+out:
+	if (!ok)
+		fprintf(stderr, "dwm: ignoring unreadable state snapshot %s\n", path);
+	free(sc);
+	free(sm);
+	free(scl);
+	free(stack);
+	fclose(f);
+	return nsnapc;
+}
+
+/* Restores list and focus stack order of the adopted windows and drops
+ * the snapshot classes no window came back for. */
+void
+_snap_restore(void)
+{
+	Client *c;
+	Class *cls, *next;
+	Monitor *m;
+	int i;
+
+	for (i = nsnapc - 1; i >= 0; i--)
+		if ((c = wintoclient(snapc[i].win))) {
+			detach(c);
+			attach(c);
+		}
+	for (i = nsnapc - 1; i >= 0; i--)
+		if ((c = wintoclient(snapstack[i]))) {
+			detachstack(c);
+			attachstack(c);
+		}
+	for (m = mons; m; m = m->next)
+		for (m->sel = m->stack; m->sel && !ISVISIBLE(m->sel); m->sel = m->sel->snext);
+	for (cls = classes; cls; cls = next) {
+		next = cls->next;
+		if (!cls->nclients)
+			_class_free(cls);
+	}
+}
+
+void
+_snap_free(void)
+{
+	free(snapc);
+	free(snapstack);
+	free(snapbywin);
+	free(snapcls);
+	snapc = NULL;
+	snapstack = NULL;
+	snapbywin = NULL;
+	snapcls = NULL;
+	nsnapc = nsnapcls = 0;
+}
+
+/* Sends every property read of manage() without waiting for a reply,
+ * the replies are collected by _props_reply(). */
+void
+_props_request(Window w, xcb_get_property_cookie_t *ck)
+{
+	ck[PropClass] = xcb_get_property(xcon, 0, w, XA_WM_CLASS, XA_STRING, 0, 256);
+	ck[PropTransient] = xcb_get_property(xcon, 0, w, XA_WM_TRANSIENT_FOR, XA_WINDOW, 0, 1);
+	ck[PropNetName] = xcb_get_property(xcon, 0, w, netatom[NetWMName], XCB_GET_PROPERTY_TYPE_ANY, 0, 256);
+	ck[PropName] = xcb_get_property(xcon, 0, w, XA_WM_NAME, XCB_GET_PROPERTY_TYPE_ANY, 0, 256);
+	ck[PropState] = xcb_get_property(xcon, 0, w, netatom[NetWMState], XA_ATOM, 0, 1);
+	ck[PropType] = xcb_get_property(xcon, 0, w, netatom[NetWMWindowType], XA_ATOM, 0, 1);
+	ck[PropNormalHints] = xcb_get_property(xcon, 0, w, XA_WM_NORMAL_HINTS, XA_WM_SIZE_HINTS, 0, 18);
+	ck[PropHints] = xcb_get_property(xcon, 0, w, XA_WM_HINTS, XA_WM_HINTS, 0, 9);
+}
+
+/* NULL when the property is missing or has an unexpected type */
+xcb_get_property_reply_t *
+_prop_reply(xcb_get_property_cookie_t ck)
+{
+	xcb_generic_error_t *err = NULL;
+	xcb_get_property_reply_t *r;
+
+	r = xcb_get_property_reply(xcon, ck, &err);
+	free(err); /* BadWindow, the window is gone and unmanaged later */
+	if (r && (!r->type || !xcb_get_property_value_length(r))) {
+		free(r);
+		r = NULL;
+	}
+	return r;
+}
+
+void
+_props_reply(xcb_get_property_cookie_t *ck, xcb_get_property_reply_t **r)
+{
+	for (int i = 0; i < PropLast; i++)
+		r[i] = _prop_reply(ck[i]);
+}
+
+uint32_t *
+_prop_card32(xcb_get_property_reply_t *r, uint min)
+{
+	return r && r->format == 32 && r->value_len >= min ? xcb_get_property_value(r) : NULL;
+}
+
+Atom
+_prop_atom(xcb_get_property_reply_t *r)
+{
+	uint32_t *v = _prop_card32(r, 1);
+
+	return v ? *v : None;
+}
+
+int
+_prop_text(xcb_get_property_reply_t *r, char *text, uint size)
+{
+	char **list = NULL;
+	int n, len;
+	XTextProperty name;
+
+	text[0] = '\0';
+	if (!r)
+		return 0;
+	name.value = xcb_get_property_value(r);
+	name.encoding = r->type;
+	name.format = r->format;
+	name.nitems = r->value_len;
+	len = xcb_get_property_value_length(r);
+	if (name.encoding == XA_STRING) {
+		len = strnlen((char *)name.value, MIN((uint)len, size - 1));
+		memcpy(text, name.value, len);
+		text[len] = '\0';
+	} else if (XmbTextPropertyToTextList(dpy, &name, &list, &n) >= Success && n > 0 && *list) {
+		strncpy(text, *list, size - 1);
+		XFreeStringList(list);
+	}
+	text[size - 1] = '\0';
+	return 1;
+}
+
+int
+_prop_sizehints(xcb_get_property_reply_t *r, XSizeHints *size)
+{
+	int32_t *v;
+
+	/* 15 fields before ICCCM 1.0, as accepted by XGetWMNormalHints() */
+	if (!(v = (int32_t *)_prop_card32(r, 15)))
+		return 0;
+	size->flags = (uint32_t)v[0];
+	size->x = v[1];
+	size->y = v[2];
+	size->width = v[3];
+	size->height = v[4];
+	size->min_width = v[5];
+	size->min_height = v[6];
+	size->max_width = v[7];
+	size->max_height = v[8];
+	size->width_inc = v[9];
+	size->height_inc = v[10];
+	size->min_aspect.x = v[11];
+	size->min_aspect.y = v[12];
+	size->max_aspect.x = v[13];
+	size->max_aspect.y = v[14];
+	if (r->value_len >= 18) {
+		size->base_width = v[15];
+		size->base_height = v[16];
+		size->win_gravity = v[17];
+	} else
+		size->flags &= ~(PBaseSize|PWinGravity);
+	return 1;
+}
+
+int
+_prop_wmhints(xcb_get_property_reply_t *r, XWMHints *wmh)
+{
+	uint32_t *v;
+
+	if (!(v = _prop_card32(r, 8)))
+		return 0;
+	wmh->flags = v[0];
+	wmh->input = v[1];
+	wmh->initial_state = v[2];
+	wmh->icon_pixmap = v[3];
+	wmh->icon_window = v[4];
+	wmh->icon_x = (int32_t)v[5];
+	wmh->icon_y = (int32_t)v[6];
+	wmh->icon_mask = v[7];
+	wmh->window_group = r->value_len >= 9 ? v[8] : 0;
+	if (r->value_len < 9)
+		wmh->flags &= ~WindowGroupHint;
+	return 1;
+}
+
 void
 manage(Window w, XWindowAttributes *wa)
+{
+	xcb_get_property_cookie_t ck[PropLast];
+
+	_props_request(w, ck);
+	MEASURE(MetManage, w, _manage(w, wa, ck, 0));
+}
+
+/* With adopt set the window is one of many taken over by scan(),
+ * which focuses once at the end. */
+void
+_manage(Window w, XWindowAttributes *wa, xcb_get_property_cookie_t *ck, int adopt)
 {
 	Client *c, *t = NULL;
 	Window trans = None;
 	XWindowChanges wc;
+	SnapClient *sc = adopt ? _snap_client(w) : NULL;
+	xcb_get_property_reply_t *r[PropLast];
+	XSizeHints size;
+	XWMHints wmh;
+	uint32_t *v;
+	ulong r0;
 
 	c = ecalloc(1, sizeof(Client));
 	c->win = w;
@@ -2097,17 +3322,40 @@ manage(Window w, XWindowAttributes *wa)
 	c->h = c->oldh = wa->height;
 	c->oldbw = wa->border_width;
 
-	{
-		const char *class, *instance;
-		XClassHint ch = { NULL, NULL };
-
-		XGetClassHint(dpy, c->win, &ch);
-		class    = ch.res_class ? ch.res_class : broken;
-		instance = ch.res_name  ? ch.res_name  : broken;
+	_props_reply(ck, r);
 
-		c->class = _class_find_or_create(class);
+	{
+		const char *class = broken, *instance = broken;
+		char ch[1024 + 1];
+
+		if (r[PropClass] && r[PropClass]->format == 8) {
+			/* "instance\0class\0" */
+			int len = MIN(xcb_get_property_value_length(r[PropClass]), sizeof ch - 1);
+			memcpy(ch, xcb_get_property_value(r[PropClass]), len);
+			ch[len] = '\0';
+			instance = ch;
+			class = ch + MIN(strlen(ch) + 1, len);
+		}
 
-		if (XGetTransientForHint(dpy, w, &trans) && (t = wintoclient(trans))) {
+		if (sc && sc->cls >= 0 && sc->cls < nsnapcls)
+			c->class = snapcls[sc->cls];
+		else
+			c->class = _class_find_or_create(class);
+		c->class->nclients++;
+
+		if ((v = _prop_card32(r[PropTransient], 1)))
+			trans = *v;
+		if (sc) {
+			/* restored as it was before reload(), no rules */
+			c->mon = _snap_mon(sc->mon);
+			c->tags = sc->tags;
+			c->params = sc->params;
+			c->isfloating = sc->isfloating;
+			c->x = c->oldx = sc->x;
+			c->y = c->oldy = sc->y;
+			c->w = c->oldw = sc->w;
+			c->h = c->oldh = sc->h;
+		} else if (trans != None && (t = wintoclient(trans))) {
 			c->mon = t->mon;
 			c->tags = t->tags;
 			c->params = t->params;
@@ -2127,11 +3375,6 @@ manage(Window w, XWindowAttributes *wa)
 				c->params = c->mon->sel ? c->mon->sel->params : c->class->params;
 			}
 		}
-
-		if (ch.res_class)
-			XFree(ch.res_class);
-		if (ch.res_name)
-			XFree(ch.res_name);
 	}
 
 	Monitor *m = c->mon;
@@ -2144,13 +3387,23 @@ manage(Window w, XWindowAttributes *wa)
 	c->bw = BORDER_PX;
 
 	wc.border_width = c->bw;
-	updatetitle(c);
+	if (!_prop_text(r[PropNetName], c->name, sizeof c->name))
+		_prop_text(r[PropName], c->name, sizeof c->name);
+	if (c->name[0] == '\0') /* hack to mark broken clients */
+		strcpy(c->name, broken);
+	r0 = NextRequest(dpy);
 	XConfigureWindow(dpy, w, CWBorderWidth, &wc);
+	c->sentbw = c->bw;
 	XSetWindowBorder(dpy, w, scheme[SchemeNormal][ColBorder].pixel);
 	configure(c); /* propagates border_width, if size doesn't change */
-	updatewindowtype(c);
-	updatesizehints(c);
-	updatewmhints(c);
+	_updatewindowtype(c, _prop_atom(r[PropState]), _prop_atom(r[PropType]));
+	if (!_prop_sizehints(r[PropNormalHints], &size))
+		size.flags = PSize;
+	_updatesizehints(c, &size);
+	if (_prop_wmhints(r[PropHints], &wmh))
+		_updatewmhints(c, &wmh);
+	for (int i = 0; i < PropLast; i++)
+		free(r[i]);
 	XSelectInput(dpy, w, EnterWindowMask|FocusChangeMask|PropertyChangeMask|StructureNotifyMask);
 	grabbuttons(c, 0);
 	if (!c->isfloating)
@@ -2159,18 +3412,114 @@ manage(Window w, XWindowAttributes *wa)
 		XRaiseWindow(dpy, c->win);
 	attach(c);
 	attachstack(c);
+	_wintab_put(c->win, c, NULL);
 	XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32, PropModeAppend,
 		(unsigned char *) &(c->win), 1);
 	XMoveResizeWindow(dpy, c->win, c->x + 2 * sw, c->y, c->w, c->h); /* some windows require this */
 	setclientstate(c, NormalState);
 
-	if (m == selmon)
+	if (m == selmon && !adopt)
 		unfocus(m->sel, 0);
 	m->sel = c;
 
 	arrange(m);
 	XMapWindow(dpy, c->win);
-	focus(NULL);
+	_req_batch(c, r0);
+	m->nstackwins = 0; /* mapped on top, restack all */
+	ipcevent(IpcEvManage, c, m, 0);
+	if (!adopt)
+		focus(NULL);
+}
+
+/* Accounts a MEASURE()d call that started at t0, with request r0 and
+ * round trip rt0. */
+void
+measured(int met, unsigned long arg, uint64_t t0, ulong r0, ulong rt0)
+{
+	Metric *mt = &metrics[met];
+	uint64_t t1 = nsnow(), us = (t1 - t0) / 1000;
+	int b;
+
+	for (b = 0; b < METRIC_BUCKETS && us >= 1ULL << b; b++);
+	mt->hist[b]++;
+	mt->count++;
+	mt->ns += t1 - t0;
+	mt->requests += NextRequest(dpy) - r0;
+#ifdef AUDIT
+	ulong rt = roundtrips - rt0;
+
+	mt->roundtrips += rt;
+	mt->rtmax = MAX(mt->rtmax, rt);
+	if (rt > rtbudget[met]) {
+		/* the first time only, auditreport() has the rest */
+		if (!mt->rtover++)
+			fprintf(stderr, "dwm: %s took %lu round trips, budget %d\n",
+				metname[met], rt, rtbudget[met]);
+		if (AUDIT_ABORT)
+			abort();
+	}
+#endif /* AUDIT */
+#ifdef TRACE
+	tracerec(metname[met], arg, t0, t1);
+#endif /* TRACE */
+}
+
+/* Writes the metrics in the Prometheus text format, replacing the file
+ * at once so that a textfile collector never reads half of it. */
+void
+metricsdump(const Arg *arg)
+{
+	char path[PATH_MAX], tmp[PATH_MAX + 4];
+	const Metric *mt;
+	ulong n;
+	FILE *f = NULL;
+	int b, i, fd;
+
+	_runtime_path(path, sizeof path, METRICS_FILE);
+	snprintf(tmp, sizeof tmp, "%s.new", path);
+	if ((fd = open(tmp, O_WRONLY|O_CREAT|O_TRUNC|O_NOFOLLOW|O_CLOEXEC, 0644)) < 0
+	|| !(f = fdopen(fd, "w"))) {
+		fprintf(stderr, "dwm: cannot write metrics %s: %s\n", tmp, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+	fputs("# HELP dwm_duration_seconds Time spent in handlers and deferred work.\n"
+	      "# TYPE dwm_duration_seconds histogram\n", f);
+	for (i = 0; i < MetLast; i++) {
+		if (!metname[i])
+			continue;
+		mt = &metrics[i];
+		for (b = 0, n = 0; b < METRIC_BUCKETS; b++) {
+			n += mt->hist[b];
+			fprintf(f, "dwm_duration_seconds_bucket{path=\"%s\",le=\"%g\"} %lu\n",
+				metname[i], (1UL << b) / 1e6, n);
+		}
+		fprintf(f, "dwm_duration_seconds_bucket{path=\"%s\",le=\"+Inf\"} %lu\n"
+			"dwm_duration_seconds_sum{path=\"%s\"} %.9f\n"
+			"dwm_duration_seconds_count{path=\"%s\"} %lu\n",
+			metname[i], mt->count, metname[i], mt->ns / 1e9, metname[i], mt->count);
+	}
+	fputs("# HELP dwm_path_x_requests_total X requests issued by handlers and deferred work.\n"
+	      "# TYPE dwm_path_x_requests_total counter\n", f);
+	for (i = 0; i < MetLast; i++)
+		if (metname[i])
+			fprintf(f, "dwm_path_x_requests_total{path=\"%s\"} %lu\n",
+				metname[i], metrics[i].requests);
+	fprintf(f, "# HELP dwm_x_requests_total X requests issued on dwm's connection.\n"
+		"# TYPE dwm_x_requests_total counter\n"
+		"dwm_x_requests_total %lu\n"
+		"# HELP dwm_x_syncs_total XSync() round trips since startup.\n"
+		"# TYPE dwm_x_syncs_total counter\n"
+		"dwm_x_syncs_total %lu\n"
+		"# HELP dwm_restacks_skipped_total Restacks that found the stacking unchanged.\n"
+		"# TYPE dwm_restacks_skipped_total counter\n"
+		"dwm_restacks_skipped_total %lu\n",
+		NextRequest(dpy) - 1, nsyncs, restackskip);
+	if (fclose(f) == EOF || rename(tmp, path) < 0) {
+		fprintf(stderr, "dwm: cannot write metrics %s: %s\n", path, strerror(errno));
+		unlink(tmp);
+	}
 }
 
 void
@@ -2207,7 +3556,7 @@ monocle(Monitor *m)
 	if (n > 0) /* override layout symbol */
 		snprintf(m->ltsymbol, sizeof m->ltsymbol, "[%d]", n);
 	for (c = nexttiled(m->clients); c; c = nexttiled(c->next))
-		resize(c, m->wx, m->wy, m->ww - 2 * c->bw, m->wh - 2 * c->bw, 0);
+		plan(c, m->wx, m->wy, m->ww - 2 * c->bw, m->wh - 2 * c->bw);
 }
 
 void
@@ -2241,6 +3590,7 @@ movemouse(const Arg *arg)
 	if (c->isfullscreen) /* no support moving fullscreen windows by mouse */
 		return;
 	restack(selmon);
+	flushdirty();
 	ocx = c->x;
 	ocy = c->y;
 	if (XGrabPointer(dpy, root, False, MOUSEMASK, GrabModeAsync, GrabModeAsync,
@@ -2280,6 +3630,7 @@ movemouse(const Arg *arg)
 				resize(c, nx, ny, c->w, c->h, 1);
 			break;
 		}
+		flushdirty();
 	} while (ev.type != ButtonRelease);
 	XUngrabPointer(dpy, CurrentTime);
 	if ((m = recttomon(c->x, c->y, c->w, c->h)) != selmon) {
@@ -2296,6 +3647,64 @@ nexttiled(Client *c)
 	return c;
 }
 
+uint64_t
+nsnow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Adds where a layout wants c to the plan, committed by plancommit()
+ * after the layout has placed every client. */
+Geom *
+plan(Client *c, int x, int y, int w, int h)
+{
+	Geom *g;
+
+	if (nplans == plansz) {
+		plansz = plansz ? plansz * 2 : 16;
+		if (!(plans = realloc(plans, plansz * sizeof *plans)))
+			die("realloc:");
+	}
+	applysizehints(c, &x, &y, &w, &h, 0);
+	g = &plans[nplans++];
+	*g = (Geom){ c, x, y, w, h, c->bw };
+	return g;
+}
+
+/* Moves and resizes the planned clients, sending only what changed and
+ * nothing at all to clients that stay put. run() flushes it all at once. */
+void
+plancommit(void)
+{
+	XWindowChanges wc;
+	Client *c;
+	Geom *g;
+	uint mask;
+	ulong r0;
+
+	for (g = plans; g < plans + nplans; g++) {
+		c = g->c;
+		mask = (g->x != c->x ? CWX : 0) | (g->y != c->y ? CWY : 0)
+			| (g->w != c->w ? CWWidth : 0) | (g->h != c->h ? CWHeight : 0)
+			| (g->bw != c->sentbw ? CWBorderWidth : 0);
+		if (!mask)
+			continue;
+		c->oldx = c->x; c->x = wc.x = g->x;
+		c->oldy = c->y; c->y = wc.y = g->y;
+		c->oldw = c->w; c->w = wc.width = g->w;
+		c->oldh = c->h; c->h = wc.height = g->h;
+		c->sentbw = wc.border_width = g->bw;
+		r0 = NextRequest(dpy);
+		XConfigureWindow(dpy, c->win, mask, &wc);
+		configure(c);
+		_req_batch(c, r0);
+	}
+	nplans = 0;
+}
+
 void
 pop(Client *c)
 {
@@ -2308,6 +3717,77 @@ pop(Client *c)
 	arrange(c->mon);
 }
 
+/* Rewrites the exported state under the sequence lock, see ipc.h. */
+void
+publishstate(void)
+{
+	uint32_t seq, n = 0, nm = 0;
+	Monitor *m;
+	Client *c;
+	Class *cls;
+	LayoutParams *p;
+	ShmMon *sm;
+	ShmClient *sc;
+
+	if (!shm)
+		return;
+	seq = shm->seq;
+	__atomic_store_n(&shm->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	/* numbers all classes, not only the exported ones */
+	for (cls = classes; cls; cls = cls->next, n++) {
+		cls->idx = n;
+		if (n >= SHM_CLASSES_MAX)
+			continue;
+		snprintf(shm->classes[n].name, sizeof shm->classes[n].name, "%s", cls->name);
+		shm->classes[n].nclients = cls->nclients;
+	}
+	classmoved = 0;
+	shm->nclasses = MIN(n, SHM_CLASSES_MAX);
+
+	n = 0;
+	shm->selmon = 0;
+	for (m = mons; m && nm < SHM_MONS_MAX; m = m->next, nm++) {
+		sm = &shm->mons[nm];
+		p = _layout_params(m);
+		if (m == selmon)
+			shm->selmon = nm;
+		sm->num = m->num;
+		sm->x = m->wx;
+		sm->y = m->wy;
+		sm->w = m->ww;
+		sm->h = m->wh;
+		sm->curtags = m->curtags;
+		sm->prevtags = m->prevtags;
+		sm->curcls = m->curcls && m->curcls->idx < SHM_CLASSES_MAX ? m->curcls->idx : -1;
+		sm->prevcls = m->prevcls && m->prevcls->idx < SHM_CLASSES_MAX ? m->prevcls->idx : -1;
+		sm->sel = m->sel ? m->sel->win : 0;
+		sm->nmaster = p->nmaster;
+		sm->mfact = p->mfact;
+		snprintf(sm->ltsymbol, sizeof sm->ltsymbol, "%s", m->ltsymbol);
+		for (c = m->clients; c && n < SHM_CLIENTS_MAX; c = c->next, n++) {
+			sc = &shm->clients[n];
+			sc->win = c->win;
+			sc->mon = nm;
+			sc->cls = c->class->idx < SHM_CLASSES_MAX ? c->class->idx : -1;
+			sc->tags = c->tags;
+			sc->x = c->x;
+			sc->y = c->y;
+			sc->w = c->w;
+			sc->h = c->h;
+			sc->flags = (c->isfloating ? ShmFloating : 0)
+				| (c->isurgent ? ShmUrgent : 0)
+				| (c->isfullscreen ? ShmFullscreen : 0);
+			snprintf(sc->name, sizeof sc->name, "%s", c->name);
+		}
+	}
+	shm->nmons = nm;
+	shm->nclients = n;
+
+	__atomic_store_n(&shm->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
 void
 propertynotify(XEvent *e)
 {
@@ -2339,6 +3819,8 @@ propertynotify(XEvent *e)
 		}
 		if (ev->atom == XA_WM_NAME || ev->atom == netatom[NetWMName]) {
 			updatetitle(c);
+			ipcevent(IpcEvTitle, c, m, 0);
+			setdirty(m, 1 << DirtyExport);
 			if (c == m->sel)
 				drawbar(m);
 		}
@@ -2376,10 +3858,60 @@ recttomon(int x, int y, int w, int h)
 void
 reload(const Arg *arg)
 {
+	clock_gettime(CLOCK_MONOTONIC, &reloadts);
 	return_code = EXIT_RELOAD;
 	running = 0;
 }
 
+/* Notes the requests sent since serial first as a batch for c. Requests
+ * are not synced, so an error for one of them arrives later and is
+ * matched to the batch by its serial in xerror(). */
+void
+_req_batch(Client *c, ulong first)
+{
+	ulong last = NextRequest(dpy) - 1;
+	ReqBatch *b = &reqring[(reqhead - 1) & (REQ_RING - 1)];
+
+	if (last < first)
+		return;
+	if (reqhead && b->c == c && b->last + 1 == first) {
+		b->last = last;
+		return;
+	}
+	b = &reqring[reqhead++ & (REQ_RING - 1)];
+	b->first = first;
+	b->last = last;
+	b->c = c;
+}
+
+/* Returns the batch holding the request with serial, NULL if it is not
+ * a client request or too old. Batches are noted in serial order. */
+ReqBatch *
+_req_find(ulong serial)
+{
+	ReqBatch *b;
+	uint i;
+
+	for (i = 1; i <= REQ_RING && i <= reqhead; i++) {
+		b = &reqring[(reqhead - i) & (REQ_RING - 1)];
+		if (b->last < serial)
+			break;
+		if (b->first <= serial)
+			return b;
+	}
+	return NULL;
+}
+
+/* Keeps the batches of c, so its late errors stay harmless, but drops
+ * the client about to be freed. */
+void
+_req_forget(Client *c)
+{
+	for (int i = 0; i < REQ_RING; i++)
+		if (reqring[i].c == c)
+			reqring[i].c = NULL;
+}
+
 void
 resize(Client *c, int x, int y, int w, int h, int interact)
 {
@@ -2391,15 +3923,16 @@ void
 resizeclient(Client *c, int x, int y, int w, int h)
 {
 	XWindowChanges wc;
+	ulong r0 = NextRequest(dpy);
 
 	c->oldx = c->x; c->x = wc.x = x;
 	c->oldy = c->y; c->y = wc.y = y;
 	c->oldw = c->w; c->w = wc.width = w;
 	c->oldh = c->h; c->h = wc.height = h;
-	wc.border_width = c->bw;
+	c->sentbw = wc.border_width = c->bw;
 	XConfigureWindow(dpy, c->win, CWX|CWY|CWWidth|CWHeight|CWBorderWidth, &wc);
 	configure(c);
-	XSync(dpy, False);
+	_req_batch(c, r0);
 }
 
 void
@@ -2416,6 +3949,7 @@ resizemouse(const Arg *arg)
 	if (c->isfullscreen) /* no support resizing fullscreen windows by mouse */
 		return;
 	restack(selmon);
+	flushdirty();
 	ocx = c->x;
 	ocy = c->y;
 	if (XGrabPointer(dpy, root, False, MOUSEMASK, GrabModeAsync, GrabModeAsync,
@@ -2453,6 +3987,7 @@ resizemouse(const Arg *arg)
 				resize(c, c->x, c->y, nw, nh, 1);
 			break;
 		}
+		flushdirty();
 	} while (ev.type != ButtonRelease);
 
 	XWarpPointer(dpy, None, c->win, 0, 0, 0, 0, c->w + c->bw - 1, c->h + c->bw - 1);
@@ -2466,68 +4001,324 @@ resizemouse(const Arg *arg)
 }
 
 void
-restack(Monitor *m)
+restack(Monitor *m)
+{
+	setdirty(m, 1 << DirtyRestack | 1 << DirtyBar);
+}
+
+/* Crossings caused by the restack carry the serial of one of its
+ * requests. The NoOp makes sure later ones carry a newer serial, even
+ * when dwm sends nothing else. */
+void
+_restack_fence(void)
+{
+	enterserial = NextRequest(dpy) - 1;
+	XNoOp(dpy);
+}
+
+/* Puts w at position i of the stacking order to apply, widening the
+ * run from first to last that differs from the order applied last. */
+void
+_restack_put(Monitor *m, int i, Window w, int *first, int *last)
+{
+	if (i == m->stackwinsz) {
+		m->stackwinsz = m->stackwinsz ? m->stackwinsz * 2 : 16;
+		if (!(m->stackwins = realloc(m->stackwins, m->stackwinsz * sizeof(Window))))
+			die("realloc:");
+	}
+	if (i < m->nstackwins && m->stackwins[i] == w)
+		return;
+	m->stackwins[i] = w;
+	if (*first < 0)
+		*first = i;
+	*last = i;
+}
+
+void
+_restack(Monitor *m)
+{
+	Client *c;
+	int n, first = -1, last = -1, raised = 0;
+	ulong r0;
+
+	dirtyrun[DirtyRestack]++;
+	if (!m->sel)
+		return;
+
+	const Layout *lt = _current_layout(m);
+	if (m->sel->isfloating || !lt || !lt->arrange) {
+		r0 = NextRequest(dpy);
+		XRaiseWindow(dpy, m->sel->win);
+		_req_batch(m->sel, r0);
+		raised = 1;
+	}
+	if (!lt || !lt->arrange) {
+		_restack_fence();
+		return;
+	}
+
+	/* the bar, then the tiled clients below it */
+	n = 0;
+	_restack_put(m, n++, m->barwin, &first, &last);
+	for (c = m->stack; c; c = c->snext)
+		if (!c->isfloating && ISVISIBLE(c))
+			_restack_put(m, n++, c->win, &first, &last);
+	m->nstackwins = n;
+	if (first < 0) {
+		restackskip++;
+		if (raised)
+			_restack_fence();
+		return;
+	}
+	/* restack the changed run below the window above it */
+	first = first ? first - 1 : 0;
+	r0 = NextRequest(dpy);
+	XRestackWindows(dpy, &m->stackwins[first], last - first + 1);
+	_req_batch(NULL, r0);
+	_restack_fence();
+}
+
+void
+run(void)
+{
+	struct epoll_event evs[LENGTH(fds)];
+	XEvent ev;
+	int i, n;
+
+	/* main event loop */
+	xsync();
+	while (running) {
+		statusflush();
+		flushdirty();
+		for (i = FdClients; i < LENGTH(fds); i++)
+			if (fds[i] >= 0 && ipcclients[i - FdClients].head != ipcclients[i - FdClients].tail)
+				ipcflush(i);
+		if (timersdirty)
+			_timer_arm();
+		/* the fd only shows what Xlib has not read yet: wait with an
+		 * empty queue and everything written out */
+		XFlush(dpy);
+		if (!QLength(dpy)) {
+			if ((n = epoll_wait(epfd, evs, LENGTH(evs), -1)) < 0) {
+				if (errno == EINTR)
+					continue;
+				die("dwm: epoll_wait:");
+			}
+			for (i = 0; i < n; i++)
+				switch (evs[i].data.u32) {
+				case FdX:
+					break;
+				case FdIpc:
+					ipcaccept();
+					break;
+				case FdStatus:
+					statusread();
+					break;
+				case FdTimer:
+					timerrun();
+					break;
+				case FdSignal:
+					sigread();
+					break;
+				default:
+					/* dropped earlier in this batch */
+					if (fds[evs[i].data.u32] < 0)
+						break;
+					if (evs[i].events & EPOLLOUT)
+						ipcflush(evs[i].data.u32);
+					if (fds[evs[i].data.u32] >= 0 && evs[i].events & (EPOLLIN|EPOLLHUP|EPOLLERR))
+						ipcmessage(evs[i].data.u32);
+				}
+		}
+		/* drain everything queued, including what handlers read in
+		 * with their replies, before doing deferred work */
+		while (running && XPending(dpy)) {
+			XNextEvent(dpy, &ev);
+			if (handler[ev.type])
+				MEASURE(MetEvent + ev.type, ev.xany.window,
+					handler[ev.type](&ev)); /* call handler */
+		}
+	}
+}
+
+/* Writes what loadstate() needs to bring the next dwm up as this one. */
+void
+savestate(void)
 {
+	char path[PATH_MAX];
+	FILE *f = NULL;
+	SnapHeader h = { SNAP_MAGIC, sizeof(SnapClient) };
+	SnapClass sc;
+	SnapMon sm;
+	SnapClient scl;
+	Monitor *m;
 	Client *c;
-	XEvent ev;
-	XWindowChanges wc;
-
-	drawbar(m);
-	if (!m->sel)
+	Class *cls;
+	int fd, n;
+
+	_runtime_path(path, sizeof path, RELOAD_STATE);
+	if ((fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_NOFOLLOW, 0600)) < 0
+	|| !(f = fdopen(fd, "w"))) {
+		fprintf(stderr, "dwm: cannot write state snapshot %s: %s\n", path, strerror(errno));
+		if (fd >= 0)
+			close(fd);
 		return;
+	}
 
-	const Layout *lt = _current_layout(m);
-	if (m->sel->isfloating || !lt || !lt->arrange)
-		XRaiseWindow(dpy, m->sel->win);
-	if (lt && lt->arrange) {
-		wc.stack_mode = Below;
-		wc.sibling = m->barwin;
-		for (c = m->stack; c; c = c->snext)
-			if (!c->isfloating && ISVISIBLE(c)) {
-				XConfigureWindow(dpy, c->win, CWSibling|CWStackMode, &wc);
-				wc.sibling = c->win;
-			}
+	h.reloadts = reloadts;
+	h.nclasses = nclasses;
+	h.selmon = selmon->num;
+	for (m = mons; m; m = m->next) {
+		h.nmons++;
+		for (c = m->clients; c; c = c->next)
+			h.nclients++;
 	}
-	XSync(dpy, False);
-	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
-}
+	fwrite(&h, sizeof h, 1, f);
+
+	for (cls = classes, n = 0; cls; cls = cls->next) {
+		cls->idx = n++;
+		memset(&sc, 0, sizeof sc);
+		memcpy(sc.name, cls->name, sizeof sc.name);
+		sc.params = cls->params;
+		fwrite(&sc, sizeof sc, 1, f);
+	}
+	classmoved = 0;
+	for (m = mons; m; m = m->next) {
+		memset(&sm, 0, sizeof sm);
+		sm.num = m->num;
+		sm.curtags = m->curtags;
+		sm.prevtags = m->prevtags;
+		sm.curcls = m->curcls ? m->curcls->idx : -1;
+		sm.prevcls = m->prevcls ? m->prevcls->idx : -1;
+		sm.showbar = m->showbar;
+		fwrite(&sm, sizeof sm, 1, f);
+	}
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next) {
+			memset(&scl, 0, sizeof scl);
+			scl.win = c->win;
+			scl.mon = m->num;
+			scl.cls = c->class->idx;
+			scl.tags = c->tags;
+			scl.params = c->params;
+			if (c->isfullscreen) { /* comes back fullscreen by _NET_WM_STATE */
+				scl.x = c->oldx;
+				scl.y = c->oldy;
+				scl.w = c->oldw;
+				scl.h = c->oldh;
+				scl.isfloating = c->oldstate;
+			} else {
+				scl.x = c->x;
+				scl.y = c->y;
+				scl.w = c->w;
+				scl.h = c->h;
+				scl.isfloating = c->isfloating;
+			}
+			fwrite(&scl, sizeof scl, 1, f);
+		}
+	for (m = mons; m; m = m->next)
+		for (c = m->stack; c; c = c->snext)
+			fwrite(&c->win, sizeof c->win, 1, f);
 
-void
-run(void)
-{
-	XEvent ev;
-	/* main event loop */
-	XSync(dpy, False);
-	while (running && !XNextEvent(dpy, &ev))
-		if (handler[ev.type])
-			handler[ev.type](&ev); /* call handler */
+	if (ferror(f) | fclose(f)) {
+		fprintf(stderr, "dwm: cannot write state snapshot %s\n", path);
+		unlink(path);
+	}
 }
 
 void
 scan(void)
 {
-	uint i, num;
+	uint i, num, n = 0;
 	Window d1, d2, *wins = NULL;
-	XWindowAttributes wa;
+	XWindowAttributes *wa;
+	xcb_get_window_attributes_cookie_t *ac;
+	xcb_get_geometry_cookie_t *gc;
+	xcb_get_property_cookie_t *sc, *tc, *pc;
+	xcb_get_window_attributes_reply_t *a;
+	xcb_get_geometry_reply_t *g;
+	xcb_get_property_reply_t *st, *tr;
+	xcb_generic_error_t *err;
+	uint32_t *v;
+	int *trans, pass;
+	struct timespec t0, t1;
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	loadstate();
+	if (!XQueryTree(dpy, root, &d1, &d2, &wins, &num)) {
+		_snap_free();
+		return;
+	}
 
-	if (XQueryTree(dpy, root, &d1, &d2, &wins, &num)) {
-		for (i = 0; i < num; i++) {
-			if (!XGetWindowAttributes(dpy, wins[i], &wa)
-			|| wa.override_redirect || XGetTransientForHint(dpy, wins[i], &d1))
-				continue;
-			if (wa.map_state == IsViewable || getstate(wins[i]) == IconicState)
-				manage(wins[i], &wa);
-		}
-		for (i = 0; i < num; i++) { /* now the transients */
-			if (!XGetWindowAttributes(dpy, wins[i], &wa))
-				continue;
-			if (XGetTransientForHint(dpy, wins[i], &d1)
-			&& (wa.map_state == IsViewable || getstate(wins[i]) == IconicState))
-				manage(wins[i], &wa);
+	/* one pipelined pass over all children instead of a round trip
+	 * per request and window */
+	ac = ecalloc(num, sizeof *ac);
+	gc = ecalloc(num, sizeof *gc);
+	sc = ecalloc(num, sizeof *sc);
+	tc = ecalloc(num, sizeof *tc);
+	for (i = 0; i < num; i++) {
+		ac[i] = xcb_get_window_attributes(xcon, wins[i]);
+		gc[i] = xcb_get_geometry(xcon, wins[i]);
+		sc[i] = xcb_get_property(xcon, 0, wins[i], wmatom[WMState], wmatom[WMState], 0, 2);
+		tc[i] = xcb_get_property(xcon, 0, wins[i], XA_WM_TRANSIENT_FOR, XA_WINDOW, 0, 1);
+	}
+
+	wa = ecalloc(num, sizeof *wa);
+	trans = ecalloc(num, sizeof *trans);
+	for (i = 0; i < num; i++) {
+		err = NULL;
+		a = xcb_get_window_attributes_reply(xcon, ac[i], &err);
+		free(err);
+		err = NULL;
+		g = xcb_get_geometry_reply(xcon, gc[i], &err);
+		free(err);
+		st = _prop_reply(sc[i]);
+		tr = _prop_reply(tc[i]);
+		v = _prop_card32(st, 1);
+		if (a && g && !a->override_redirect
+		&& (a->map_state == XCB_MAP_STATE_VIEWABLE || (v && *v == IconicState))) {
+			wins[n] = wins[i];
+			wa[n].x = g->x;
+			wa[n].y = g->y;
+			wa[n].width = g->width;
+			wa[n].height = g->height;
+			wa[n].border_width = g->border_width;
+			trans[n] = _prop_card32(tr, 1) != NULL;
+			n++;
 		}
-		if (wins)
-			XFree(wins);
+		free(a);
+		free(g);
+		free(st);
+		free(tr);
 	}
+	free(ac);
+	free(gc);
+	free(sc);
+	free(tc);
+
+	pc = ecalloc(n * PropLast, sizeof *pc);
+	for (i = 0; i < n; i++)
+		_props_request(wins[i], &pc[i * PropLast]);
+	for (pass = 0; pass < 2; pass++) /* now the transients */
+		for (i = 0; i < n; i++)
+			if (trans[i] == pass)
+				MEASURE(MetManage, wins[i], _manage(wins[i], &wa[i], &pc[i * PropLast], 1));
+	if (nsnapc || nsnapcls)
+		_snap_restore();
+	if (n)
+		focus(NULL);
+
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	fprintf(stderr, "dwm: adopted %u of %u windows in %ld us%s\n", n, num,
+		(t1.tv_sec - t0.tv_sec) * 1000000 + (t1.tv_nsec - t0.tv_nsec) / 1000,
+		nsnapc ? " from the reload snapshot" : "");
+	_snap_free();
+
+	free(pc);
+	free(trans);
+	free(wa);
+	if (wins)
+		XFree(wins);
 }
 
 void
@@ -2539,12 +4330,25 @@ sendmon(Client *c, Monitor *m)
 	unfocus(c, 1);
 	detach(c);
 	detachstack(c);
+	c->mon = m;
 	attach(c);
 	attachstack(c);
+	_wintab_put(c->win, c, NULL);
 	focus(NULL);
 	arrange(NULL);
 }
 
+void
+setdirty(Monitor *m, uint flags)
+{
+	int i;
+
+	for (i = 0; i < DirtyLast; i++)
+		if (flags & 1 << i)
+			dirtyreq[i]++;
+	m->dirty |= flags;
+}
+
 void
 setclientstate(Client *c, long state)
 {
@@ -2604,6 +4408,7 @@ setfullscreen(Client *c, int fullscreen)
 		c->isfloating = 1;
 		resizeclient(c, m->mx, m->my, m->mw, m->mh);
 		XRaiseWindow(dpy, c->win);
+		m->nstackwins = 0;
 	} else if (!fullscreen && c->isfullscreen){
 		XChangeProperty(dpy, c->win, netatom[NetWMState], XA_ATOM, 32,
 			PropModeReplace, (unsigned char*)0, 0);
@@ -2619,6 +4424,20 @@ setfullscreen(Client *c, int fullscreen)
 	}
 }
 
+/* Runs timerfunc[t] in ms milliseconds, replacing an earlier schedule. */
+void
+settimer(int t, long ms)
+{
+	clock_gettime(CLOCK_MONOTONIC, &timers[t]);
+	timers[t].tv_sec += ms / 1000;
+	timers[t].tv_nsec += ms % 1000 * 1000000;
+	if (timers[t].tv_nsec >= 1000000000) {
+		timers[t].tv_sec++;
+		timers[t].tv_nsec -= 1000000000;
+	}
+	timersdirty = 1;
+}
+
 void
 setlayout(const Arg *arg)
 {
@@ -2660,19 +4479,34 @@ setmfact(const Arg *arg)
 	}
 }
 
+/* Takes len bytes of text as the new status. The bars are repainted at
+ * most once per frame, see statusflush(). */
+void
+setstatus(const char *text, size_t len)
+{
+	if (len + 1 > stextsz) {
+		stextsz = len + 1;
+		if (!(stext = realloc(stext, stextsz)))
+			die("realloc:");
+	} else if (!strncmp(stext, text, len) && !stext[len])
+		return;
+	memcpy(stext, text, len);
+	stext[len] = '\0';
+	statusdirty = 1;
+}
+
 void
 setup(void)
 {
 	int i;
 	XSetWindowAttributes wa;
 	Atom utf8string;
-	struct sigaction sa;
 
-	/* do not transform children into zombies when they terminate */
-	sigemptyset(&sa.sa_mask);
-	sa.sa_flags = SA_NOCLDSTOP | SA_NOCLDWAIT | SA_RESTART;
-	sa.sa_handler = SIG_IGN;
-	sigaction(SIGCHLD, &sa, NULL);
+	/* children are reaped as SIGCHLD comes in through the signalfd */
+	setupevents();
+#ifdef AUDIT
+	XSetAfterFunction(dpy, auditafter);
+#endif /* AUDIT */
 
 	/* clean up any zombies (inherited from .xinitrc etc) immediately */
 	while (waitpid(-1, NULL, WNOHANG) > 0);
@@ -2682,7 +4516,7 @@ setup(void)
 	sw = DisplayWidth(dpy, screen);
 	sh = DisplayHeight(dpy, screen);
 	root = RootWindow(dpy, screen);
-	drw = drw_create(dpy, screen, root, sw, sh);
+	drw = drw_create(dpy, screen, root);
 	if (!drw_fontset_create(drw, fonts, LENGTH(fonts)))
 		die("no fonts could be loaded.");
 
@@ -2690,6 +4524,12 @@ setup(void)
 	lrpad_2 = lrpad / 2;
 	bh = drw->fonts->h + 2;
 
+	for (int i = LENGTH(crules) - 1; i >= 0; i--) {
+		uint h = _class_hash(crules[i].class);
+		crulenext[i] = cruletab[h];
+		cruletab[h] = &crules[i];
+	}
+
 	w_dwm_version = TEXTW(dwm_version);
 	w_ellipsis_l = TEXTW(ellipsis_l);
 	w_ellipsis_r = TEXTW(ellipsis_r);
@@ -2733,6 +4573,7 @@ setup(void)
 		scheme[i] = drw_scm_create(drw, colors[i], 3);
 	/* init bars */
 	updatebars();
+	stext = ecalloc(1, stextsz = 1);
 	updatestatus();
 	/* supporting window for NetWMCheck */
 	wmcheckwin = XCreateSimpleWindow(dpy, root, 0, 0, 1, 1, 0, 0, 0);
@@ -2755,6 +4596,115 @@ setup(void)
 	XSelectInput(dpy, root, wa.event_mask);
 	grabkeys();
 	focus(NULL);
+	setupipc();
+	setupshm();
+	setupstatus();
+	setupmodules();
+}
+
+void
+setupevents(void)
+{
+	sigset_t set;
+	int fd;
+
+	for (int i = 0; i < LENGTH(fds); i++)
+		fds[i] = -1;
+	if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+		die("dwm: epoll_create1:");
+	watchfd(FdX, ConnectionNumber(dpy), EPOLLIN);
+	if ((fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK|TFD_CLOEXEC)) < 0)
+		die("dwm: timerfd_create:");
+	watchfd(FdTimer, fd, EPOLLIN);
+
+	sigemptyset(&set);
+	sigaddset(&set, SIGCHLD);
+	sigaddset(&set, SIGUSR1);
+	sigaddset(&set, SIGUSR2); /* even without TRACE, it would kill dwm */
+	if (sigprocmask(SIG_BLOCK, &set, NULL) < 0
+	|| (fd = signalfd(-1, &set, SFD_NONBLOCK|SFD_CLOEXEC)) < 0)
+		die("dwm: signalfd:");
+	watchfd(FdSignal, fd, EPOLLIN);
+}
+
+void
+setupipc(void)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	mode_t mask;
+	int fd;
+
+	_runtime_path(ipcpath, sizeof ipcpath, IPC_SOCKET);
+	if (strlen(ipcpath) >= sizeof addr.sun_path) {
+		fprintf(stderr, "dwm: IPC socket path too long: %s\n", ipcpath);
+		return;
+	}
+	strcpy(addr.sun_path, ipcpath);
+	if ((fd = socket(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC|SOCK_NONBLOCK, 0)) < 0) {
+		perror("dwm: IPC socket");
+		return;
+	}
+	unlink(ipcpath); /* left over, checkotherwm() made sure it is ours */
+	mask = umask(0077);
+	if (bind(fd, (struct sockaddr *)&addr, sizeof addr) < 0 || listen(fd, IPC_CLIENTS_MAX) < 0) {
+		perror("dwm: IPC socket");
+		close(fd);
+		fd = -1;
+	}
+	umask(mask);
+	if (fd >= 0)
+		watchfd(FdIpc, fd, EPOLLIN);
+}
+
+void
+setupshm(void)
+{
+	void *p;
+	int fd;
+
+	_runtime_path(shmpath, sizeof shmpath, SHM_STATE);
+	unlink(shmpath); /* readers of a previous dwm keep their copy */
+	if ((fd = open(shmpath, O_RDWR|O_CREAT|O_EXCL|O_CLOEXEC|O_NOFOLLOW, 0600)) < 0) {
+		perror("dwm: state export");
+		return;
+	}
+	if (ftruncate(fd, sizeof *shm) < 0
+	|| (p = mmap(NULL, sizeof *shm, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		perror("dwm: state export");
+		unlink(shmpath);
+	} else {
+		shm = p;
+		shm->size = sizeof *shm;
+	}
+	close(fd);
+}
+
+void
+setupstatus(void)
+{
+	int fd;
+
+	_runtime_path(statuspath, sizeof statuspath, STATUS_FIFO);
+	unlink(statuspath);
+	if (mkfifo(statuspath, 0600) < 0) {
+		perror("dwm: status FIFO");
+		return;
+	}
+	/* read-write so that writers coming and going never read as EOF */
+	if ((fd = open(statuspath, O_RDWR|O_NONBLOCK|O_CLOEXEC)) < 0) {
+		perror("dwm: status FIFO");
+		unlink(statuspath);
+		return;
+	}
+	watchfd(FdStatus, fd, EPOLLIN);
+}
+
+void
+setupmodules(void)
+{
+	for (int i = 0; i < LENGTH(mstate); i++)
+		mstate[i].fd[0] = mstate[i].fd[1] = -1;
+	statustick(); /* first samples right away */
 }
 
 void
@@ -2762,6 +4712,10 @@ seturgent(Client *c, int urg)
 {
 	XWMHints *wmh;
 
+	if (c->isurgent != urg) {
+		ipcevent(IpcEvUrgent, c, c->mon, urg);
+		setdirty(c->mon, 1 << DirtyExport);
+	}
 	c->isurgent = urg;
 	if (!(wmh = XGetWMHints(dpy, c->win)))
 		return;
@@ -2773,27 +4727,51 @@ seturgent(Client *c, int urg)
 void
 showhide(Client *c)
 {
+	ulong r0;
+
 	if (!c)
 		return;
 
 	const Layout *lt = _current_layout(c->mon);
 	if (ISVISIBLE(c)) {
 		/* show clients top down */
+		r0 = NextRequest(dpy);
 		XMoveWindow(dpy, c->win, c->x, c->y);
+		_req_batch(c, r0);
 		if ((!lt || !lt->arrange || c->isfloating) && !c->isfullscreen)
 			resize(c, c->x, c->y, c->w, c->h, 0);
 		showhide(c->snext);
 	} else {
 		/* hide clients bottom up */
 		showhide(c->snext);
+		r0 = NextRequest(dpy);
 		XMoveWindow(dpy, c->win, WIDTH(c) * -2, c->y);
+		_req_batch(c, r0);
 	}
 }
 
+void
+sigread(void)
+{
+	struct signalfd_siginfo si[8];
+	ssize_t n;
+
+	/* children exiting together may have sent one SIGCHLD */
+	while ((n = read(fds[FdSignal], si, sizeof si)) > 0)
+		for (int i = 0; i < n / sizeof *si; i++)
+			if (si[i].ssi_signo == SIGUSR1)
+				metricsdump(NULL);
+#ifdef TRACE
+			else if (si[i].ssi_signo == SIGUSR2)
+				tracedump(NULL);
+#endif /* TRACE */
+	while (waitpid(-1, NULL, WNOHANG) > 0);
+}
+
 void
 spawn(const Arg *arg)
 {
-	struct sigaction sa;
+	sigset_t none;
 
 	if (arg->v == dmenucmd)
 		dmenumon[0] = '0' + selmon->num;
@@ -2802,16 +4780,201 @@ spawn(const Arg *arg)
 			close(ConnectionNumber(dpy));
 		setsid();
 
-		sigemptyset(&sa.sa_mask);
-		sa.sa_flags = 0;
-		sa.sa_handler = SIG_DFL;
-		sigaction(SIGCHLD, &sa, NULL);
+		/* the mask outlives exec, blocked signals are the signalfd's */
+		sigemptyset(&none);
+		sigprocmask(SIG_SETMASK, &none, NULL);
 
 		execvp(((char **)arg->v)[0], (char **)arg->v);
 		die("dwm: execvp '%s' failed:", ((char **)arg->v)[0]);
 	}
 }
 
+/* Reads all pending input of the status FIFO, one status per line. Only
+ * the last complete line of a burst is taken. */
+void
+statusread(void)
+{
+	char buf[4096], *end, *line;
+	ssize_t n;
+	size_t len;
+
+	while ((n = read(fds[FdStatus], buf, sizeof buf)) > 0) {
+		if (!(statusin = realloc(statusin, statusinlen + n)))
+			die("realloc:");
+		memcpy(statusin + statusinlen, buf, n);
+		statusinlen += n;
+	}
+	if (!statusinlen) /* statusin may not be allocated yet */
+		return;
+	if (statusdiscard) {
+		if (!(end = memchr(statusin, '\n', statusinlen))) {
+			statusinlen = 0;
+			return;
+		}
+		statusdiscard = 0;
+		statusinlen -= end + 1 - statusin;
+		memmove(statusin, end + 1, statusinlen);
+	}
+	for (end = statusin + statusinlen; end > statusin && end[-1] != '\n'; end--);
+	if (end == statusin) {
+		/* not a status, drop it and the rest of it still to come */
+		if (statusinlen > STATUS_MAX) {
+			statusinlen = 0;
+			statusdiscard = 1;
+		}
+		return;
+	}
+	end--; /* the last newline */
+	for (line = end; line > statusin && line[-1] != '\n'; line--);
+	/* cut at a character, not inside one */
+	if ((len = end - line) > STATUS_MAX)
+		for (len = STATUS_MAX; len && (line[len] & 0xc0) == 0x80; len--);
+	setstatus(line, len);
+	statusinlen -= end + 1 - statusin;
+	memmove(statusin, end + 1, statusinlen);
+}
+
+/* Repaints a new status once a frame has passed since the last one,
+ * until then TimerStatus waits for it. */
+void
+statusflush(void)
+{
+	struct timespec now;
+	long ms;
+
+	if (!statusdirty)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ms = (now.tv_sec - statusts.tv_sec) * 1000
+		+ (now.tv_nsec - statusts.tv_nsec) / 1000000;
+	if (ms < 1000 / REFRESH_RATE) {
+		settimer(TimerStatus, 1000 / REFRESH_RATE - ms);
+		return;
+	}
+	statusts = now;
+	statusdirty = 0;
+	setdirty(selmon, 1 << DirtyStatus);
+}
+
+/* Samples the modules whose interval is up, counted in timer ticks. */
+void
+statustick(void)
+{
+	char old[sizeof mstate[0].text];
+	struct timespec now;
+
+	for (int i = 0; i < LENGTH(smodules); i++) {
+		/* overruns count once, catching up is pointless */
+		if (statusticks % MAX(smodules[i].interval, 1))
+			continue;
+		memcpy(old, mstate[i].text, sizeof old);
+		smodules[i].func(&mstate[i], smodules[i].arg);
+		if (strcmp(old, mstate[i].text))
+			statusdirty = 1;
+	}
+	statusticks++;
+	/* tick on whole seconds, for the clock */
+	clock_gettime(CLOCK_REALTIME, &now);
+	settimer(TimerModules, 1000 - now.tv_nsec / 1000000);
+}
+
+/* Reads path from the start through the descriptor kept in *fd. */
+ssize_t
+_status_pread(int *fd, const char *path, char *buf, size_t size)
+{
+	ssize_t n;
+
+	if (*fd < 0 && (*fd = open(path, O_RDONLY|O_CLOEXEC)) < 0)
+		return -1;
+	if ((n = pread(*fd, buf, size - 1, 0)) < 0)
+		return -1;
+	buf[n] = '\0';
+	return n;
+}
+
+void
+status_battery(ModState *ms, const char *arg)
+{
+	char path[PATH_MAX], cap[16], st[32];
+
+	snprintf(path, sizeof path, "%s/capacity", arg);
+	if (_status_pread(&ms->fd[0], path, cap, sizeof cap) <= 0) {
+		ms->text[0] = '\0';
+		return;
+	}
+	snprintf(path, sizeof path, "%s/status", arg);
+	if (_status_pread(&ms->fd[1], path, st, sizeof st) <= 0)
+		st[0] = '\0';
+	snprintf(ms->text, sizeof ms->text, "bat %d%%%s", atoi(cap),
+		!strncmp(st, "Charging", 8) ? "+" : !strncmp(st, "Discharging", 11) ? "-" : "");
+}
+
+void
+status_clock(ModState *ms, const char *arg)
+{
+	time_t t = time(NULL);
+	struct tm tm;
+
+	if (!localtime_r(&t, &tm) || !strftime(ms->text, sizeof ms->text, arg, &tm))
+		ms->text[0] = '\0';
+}
+
+void
+status_cpu(ModState *ms, const char *arg)
+{
+	char buf[256];
+	unsigned long long v[8] = { 0 }, busy, total;
+
+	if (_status_pread(&ms->fd[0], "/proc/stat", buf, sizeof buf) <= 0
+	|| sscanf(buf, "cpu %llu %llu %llu %llu %llu %llu %llu %llu",
+	          &v[0], &v[1], &v[2], &v[3], &v[4], &v[5], &v[6], &v[7]) < 4) {
+		ms->text[0] = '\0';
+		return;
+	}
+	total = v[0] + v[1] + v[2] + v[3] + v[4] + v[5] + v[6] + v[7];
+	busy = total - v[3] - v[4]; /* idle, iowait */
+	if (ms->prev[1] && total > ms->prev[1])
+		snprintf(ms->text, sizeof ms->text, "cpu %2llu%%",
+			100 * (busy - ms->prev[0]) / (total - ms->prev[1]));
+	ms->prev[0] = busy;
+	ms->prev[1] = total;
+}
+
+void
+status_load(ModState *ms, const char *arg)
+{
+	char buf[32], *sp;
+
+	if (_status_pread(&ms->fd[0], "/proc/loadavg", buf, sizeof buf) <= 0
+	|| !(sp = strchr(buf, ' '))) {
+		ms->text[0] = '\0';
+		return;
+	}
+	*sp = '\0';
+	snprintf(ms->text, sizeof ms->text, "load %s", buf);
+}
+
+void
+status_mem(ModState *ms, const char *arg)
+{
+	char buf[512], *p;
+	unsigned long long total = 0, avail = 0;
+
+	if (_status_pread(&ms->fd[0], "/proc/meminfo", buf, sizeof buf) <= 0) {
+		ms->text[0] = '\0';
+		return;
+	}
+	if ((p = strstr(buf, "MemTotal:")))
+		total = strtoull(p + 9, NULL, 10);
+	if ((p = strstr(buf, "MemAvailable:")))
+		avail = strtoull(p + 13, NULL, 10);
+	if (!total || avail > total) {
+		ms->text[0] = '\0';
+		return;
+	}
+	snprintf(ms->text, sizeof ms->text, "mem %2llu%%", 100 * (total - avail) / total);
+}
+
 void
 tagmon(const Arg *arg)
 {
@@ -2882,6 +5045,7 @@ tag_set(const Arg *arg)
 		return;
 
 	selmon->sel->tags = arg->t;
+	lpgen++;
 
 	if (selmon->curtags) {
 		focus(NULL);
@@ -2948,6 +5112,7 @@ tag_stack(const Arg *arg)
 
 	selmon->curtags = t;
 	selmon->prevtags = 0;
+	lpgen++;
 	drawbar(selmon);
 }
 
@@ -3007,6 +5172,7 @@ tag_swap(const Arg *arg)
 
 	selmon->curtags = t;
 	selmon->prevtags = 0;
+	lpgen++;
 	drawbar(selmon);
 }
 
@@ -3017,6 +5183,7 @@ tag_toggle_c(const Arg *arg)
 		return;
 
 	selmon->sel->tags ^= arg->t;
+	lpgen++;
 
 	if (selmon->curtags && !(selmon->curtags & selmon->sel->tags)) {
 		focus(NULL);
@@ -3074,6 +5241,7 @@ _tile(Monitor *m, int reverse)
 {
 	int i, n, h, mw, mx, sx, my, sy;
 	Client *c;
+	Geom *g;
 
 	for (n = 0, c = nexttiled(m->clients); c; c = nexttiled(c->next), n++);
 	if (n == 0)
@@ -3092,14 +5260,14 @@ _tile(Monitor *m, int reverse)
 	for (i = my = sy = 0, c = nexttiled(m->clients); c; c = nexttiled(c->next), i++)
 		if (i < p->nmaster) {
 			h = (m->wh - my) / (MIN(n, p->nmaster) - i);
-			resize(c, m->wx + mx, m->wy + my, mw - (2*c->bw), h - (2*c->bw), 0);
-			if (my + HEIGHT(c) < m->wh)
-				my += HEIGHT(c);
+			g = plan(c, m->wx + mx, m->wy + my, mw - (2*c->bw), h - (2*c->bw));
+			if (my + g->h + 2 * c->bw < m->wh)
+				my += g->h + 2 * c->bw;
 		} else {
 			h = (m->wh - sy) / (n - i);
-			resize(c, m->wx + sx, m->wy + sy, m->ww - mw - (2*c->bw), h - (2*c->bw), 0);
-			if (sy + HEIGHT(c) < m->wh)
-				sy += HEIGHT(c);
+			g = plan(c, m->wx + sx, m->wy + sy, m->ww - mw - (2*c->bw), h - (2*c->bw));
+			if (sy + g->h + 2 * c->bw < m->wh)
+				sy += g->h + 2 * c->bw;
 		}
 }
 
@@ -3115,6 +5283,98 @@ tile_r(Monitor *m)
 	_tile(m, 1);
 }
 
+/* Points the timerfd at the earliest timer, or stops it. */
+void
+_timer_arm(void)
+{
+	struct itimerspec its = { 0 };
+	const struct timespec *next = NULL;
+
+	for (int t = 0; t < TimerLast; t++) {
+		if (!timers[t].tv_sec && !timers[t].tv_nsec)
+			continue;
+		if (!next || timers[t].tv_sec < next->tv_sec
+		|| (timers[t].tv_sec == next->tv_sec && timers[t].tv_nsec < next->tv_nsec))
+			next = &timers[t];
+	}
+	if (next)
+		its.it_value = *next;
+	timerfd_settime(fds[FdTimer], TFD_TIMER_ABSTIME, &its, NULL);
+	timersdirty = 0;
+}
+
+void
+timerrun(void)
+{
+	struct timespec now;
+	uint64_t n;
+
+	if (read(fds[FdTimer], &n, sizeof n) < 0)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (int t = 0; t < TimerLast; t++) {
+		if (!timers[t].tv_sec && !timers[t].tv_nsec)
+			continue;
+		if (timers[t].tv_sec > now.tv_sec
+		|| (timers[t].tv_sec == now.tv_sec && timers[t].tv_nsec > now.tv_nsec))
+			continue;
+		timers[t].tv_sec = timers[t].tv_nsec = 0;
+		timerfunc[t]();
+	}
+	timersdirty = 1;
+}
+
+/* Writes the flight recorder out as Chrome trace JSON, for
+ * chrome://tracing or Perfetto. */
+void
+tracedump(const Arg *arg)
+{
+#ifdef TRACE
+	char path[PATH_MAX];
+	const TraceEvent *te;
+	unsigned long i;
+	FILE *f;
+	int fd;
+
+	_runtime_path(path, sizeof path, TRACE_FILE);
+	if ((fd = open(path, O_WRONLY|O_CREAT|O_TRUNC|O_NOFOLLOW|O_CLOEXEC, 0600)) < 0
+	|| !(f = fdopen(fd, "w"))) {
+		fprintf(stderr, "dwm: cannot write trace %s: %s\n", path, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+	fputs("{\"traceEvents\":[", f);
+	for (i = tracen > TRACE_EVENTS ? tracen - TRACE_EVENTS : 0; i < tracen; i++) {
+		te = &tracering[i & (TRACE_EVENTS - 1)];
+		fprintf(f, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":1,"
+			"\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"arg\":%lu}}",
+			i == tracen - MIN(tracen, TRACE_EVENTS) ? "" : ",",
+			te->name, (int)getpid(), te->ts / 1e3, te->dur / 1e3, te->arg);
+	}
+	fputs("\n]}\n", f);
+	fclose(f);
+	fprintf(stderr, "dwm: wrote %lu trace events to %s\n", MIN(tracen, TRACE_EVENTS), path);
+#else
+	fputs("dwm: built without TRACE, nothing recorded\n", stderr);
+#endif /* TRACE */
+}
+
+#ifdef TRACE
+/* Records a call from t0 to t1. Only dwm's one thread writes the ring,
+ * old entries are overwritten without any locking. */
+void
+tracerec(const char *name, unsigned long arg, uint64_t t0, uint64_t t1)
+{
+	TraceEvent *te = &tracering[tracen++ & (TRACE_EVENTS - 1)];
+
+	te->name = name ? name : "event";
+	te->arg = arg;
+	te->ts = t0;
+	te->dur = t1 - t0;
+}
+#endif /* TRACE */
+
 void
 togglebar(const Arg *arg)
 {
@@ -3158,10 +5418,12 @@ unmanage(Client *c, int destroyed)
 	Monitor *m = c->mon;
 	XWindowChanges wc;
 
-	_class_delete_if_empty(c);
+	ipcevent(IpcEvUnmanage, c, m, 0);
+	_class_unref(c);
 
 	detach(c);
 	detachstack(c);
+	_wintab_del(c->win);
 	if (!destroyed) {
 		wc.border_width = c->oldbw;
 		XGrabServer(dpy); /* avoid race conditions */
@@ -3170,10 +5432,11 @@ unmanage(Client *c, int destroyed)
 		XConfigureWindow(dpy, c->win, CWBorderWidth, &wc); /* restore border */
 		XUngrabButton(dpy, AnyButton, AnyModifier, c->win);
 		setclientstate(c, WithdrawnState);
-		XSync(dpy, False);
+		xsync();
 		XSetErrorHandler(xerror);
 		XUngrabServer(dpy);
 	}
+	_req_forget(c);
 	free(c);
 
 	focus(NULL);
@@ -3191,7 +5454,7 @@ unmapnotify(XEvent *e)
 		if (ev->send_event)
 			setclientstate(c, WithdrawnState);
 		else
-			unmanage(c, 0);
+			MEASURE(MetUnmanage, c->win, unmanage(c, 0));
 	}
 }
 
@@ -3206,6 +5469,14 @@ updatebars(void)
 	};
 	XClassHint ch = {"dwm", "dwm"};
 	for (m = mons; m; m = m->next) {
+		/* the pixmap only follows the monitor width */
+		if (!m->barbuf || m->barbuf->w != m->ww) {
+			if (!m->barbuf)
+				m->barbuf = drw_buf_create(drw, m->ww, bh);
+			else
+				drw_resize(drw, m->barbuf, m->ww, bh);
+			memset(m->segs, 0, sizeof(m->segs));
+		}
 		if (m->barwin)
 			continue;
 		m->barwin = XCreateWindow(dpy, root, m->wx, m->by, m->ww, bh, 0, DefaultDepth(dpy, screen),
@@ -3214,6 +5485,7 @@ updatebars(void)
 		XDefineCursor(dpy, m->barwin, cursor[CurNormal]->cursor);
 		XMapRaised(dpy, m->barwin);
 		XSetClassHint(dpy, m->barwin, &ch);
+		_wintab_put(m->barwin, NULL, m);
 	}
 }
 
@@ -3295,8 +5567,10 @@ updategeom(void)
 				dirty = 1;
 				m->clients = c->next;
 				detachstack(c);
+				c->mon = mons;
 				attach(c);
 				attachstack(c);
+				_wintab_put(c->win, c, NULL);
 			}
 			if (m == selmon)
 				selmon = mons;
@@ -3347,6 +5621,14 @@ updatesizehints(Client *c)
 	if (!XGetWMNormalHints(dpy, c->win, &size, &msize))
 		/* size is uninitialized, ensure that size.flags aren't used */
 		size.flags = PSize;
+	_updatesizehints(c, &size);
+}
+
+void
+_updatesizehints(Client *c, XSizeHints *hints)
+{
+	XSizeHints size = *hints;
+
 	if (size.flags & PBaseSize) {
 		c->basew = size.base_width;
 		c->baseh = size.base_height;
@@ -3385,9 +5667,21 @@ updatesizehints(Client *c)
 void
 updatestatus(void)
 {
-	if (!gettextprop(root, XA_WM_NAME, stext, sizeof(stext)))
-		strcpy(stext, "");
-	drawbar(selmon);
+	char **list = NULL;
+	int n;
+	XTextProperty name;
+
+	if (!XGetTextProperty(dpy, root, &name, XA_WM_NAME) || !name.nitems) {
+		setstatus("", 0);
+		return;
+	}
+	if (name.encoding == XA_STRING)
+		setstatus((char *)name.value, strlen((char *)name.value));
+	else if (XmbTextPropertyToTextList(dpy, &name, &list, &n) >= Success && n > 0 && *list) {
+		setstatus(*list, strlen(*list));
+		XFreeStringList(list);
+	}
+	XFree(name.value);
 }
 
 
@@ -3406,6 +5700,12 @@ updatewindowtype(Client *c)
 	Atom state = getatomprop(c, netatom[NetWMState]);
 	Atom wtype = getatomprop(c, netatom[NetWMWindowType]);
 
+	_updatewindowtype(c, state, wtype);
+}
+
+void
+_updatewindowtype(Client *c, Atom state, Atom wtype)
+{
 	if (state == netatom[NetWMFullscreen])
 		setfullscreen(c, 1);
 	if (wtype == netatom[NetWMWindowTypeDialog])
@@ -3418,46 +5718,67 @@ updatewmhints(Client *c)
 	XWMHints *wmh;
 
 	if ((wmh = XGetWMHints(dpy, c->win))) {
-		if (c == selmon->sel && wmh->flags & XUrgencyHint) {
-			wmh->flags &= ~XUrgencyHint;
-			XSetWMHints(dpy, c->win, wmh);
-		} else
-			c->isurgent = (wmh->flags & XUrgencyHint) ? 1 : 0;
-		if (wmh->flags & InputHint)
-			c->neverfocus = !wmh->input;
-		else
-			c->neverfocus = 0;
+		_updatewmhints(c, wmh);
 		XFree(wmh);
 	}
 }
 
+void
+_updatewmhints(Client *c, XWMHints *wmh)
+{
+	if (c == selmon->sel && wmh->flags & XUrgencyHint) {
+		wmh->flags &= ~XUrgencyHint;
+		XSetWMHints(dpy, c->win, wmh);
+	} else if (c->isurgent != !!(wmh->flags & XUrgencyHint)) {
+		c->isurgent = !c->isurgent;
+		ipcevent(IpcEvUrgent, c, c->mon, c->isurgent);
+		setdirty(c->mon, 1 << DirtyExport);
+	}
+	if (wmh->flags & InputHint)
+		c->neverfocus = !wmh->input;
+	else
+		c->neverfocus = 0;
+}
+
+/* Has run() watch fd in slot i for events, or stop watching the slot
+ * with fd < 0. */
+void
+watchfd(int i, int fd, uint events)
+{
+	struct epoll_event ev = { .events = events, .data.u32 = i };
+
+	if (fd < 0) {
+		if (fds[i] >= 0)
+			epoll_ctl(epfd, EPOLL_CTL_DEL, fds[i], NULL);
+		fds[i] = -1;
+		return;
+	}
+	if (fds[i] == fd && fdevents[i] == events)
+		return;
+	if (epoll_ctl(epfd, fds[i] == fd ? EPOLL_CTL_MOD : EPOLL_CTL_ADD, fd, &ev) < 0)
+		perror("dwm: epoll_ctl");
+	fds[i] = fd;
+	fdevents[i] = events;
+}
+
 Client *
 wintoclient(Window w)
 {
-	Client *c;
-	Monitor *m;
+	WinRef *r = _wintab_find(w);
 
-	for (m = mons; m; m = m->next)
-		for (c = m->clients; c; c = c->next)
-			if (c->win == w)
-				return c;
-	return NULL;
+	return r ? r->c : NULL;
 }
 
 Monitor *
 wintomon(Window w)
 {
 	int x, y;
-	Client *c;
-	Monitor *m;
+	WinRef *r;
 
 	if (w == root && getrootptr(&x, &y))
 		return recttomon(x, y, 1, 1);
-	for (m = mons; m; m = m->next)
-		if (w == m->barwin)
-			return m;
-	if ((c = wintoclient(w)))
-		return c->mon;
+	if ((r = _wintab_find(w)))
+		return r->c ? r->c->mon : r->m;
 	return selmon;
 }
 
@@ -3467,6 +5788,8 @@ wintomon(Window w)
 int
 xerror(Display *dpy, XErrorEvent *ee)
 {
+	ReqBatch *b;
+
 	if (ee->error_code == BadWindow
 	|| (ee->request_code == X_SetInputFocus && ee->error_code == BadMatch)
 	|| (ee->request_code == X_PolyText8 && ee->error_code == BadDrawable)
@@ -3477,6 +5800,17 @@ xerror(Display *dpy, XErrorEvent *ee)
 	|| (ee->request_code == X_GrabKey && ee->error_code == BadAccess)
 	|| (ee->request_code == X_CopyArea && ee->error_code == BadDrawable))
 		return 0;
+	/* requests are not synced, a failed change of a client shows up
+	 * here later and is only logged */
+	if ((b = _req_find(ee->serial))) {
+		if (b->c)
+			fprintf(stderr, "dwm: error on window 0x%lx (%s): request code=%d, error code=%d\n",
+				b->c->win, b->c->name, ee->request_code, ee->error_code);
+		else
+			fprintf(stderr, "dwm: error on a client request: request code=%d, error code=%d\n",
+				ee->request_code, ee->error_code);
+		return 0;
+	}
 	fprintf(stderr, "dwm: fatal error: request code=%d, error code=%d\n",
 		ee->request_code, ee->error_code);
 	return xerrorxlib(dpy, ee); /* may call exit */
@@ -3497,6 +5831,14 @@ xerrorstart(Display *dpy, XErrorEvent *ee)
 	return -1;
 }
 
+/* XSync(), counted for metricsdump() */
+void
+xsync(void)
+{
+	nsyncs++;
+	XSync(dpy, False);
+}
+
 void
 zoom(const Arg *arg)
 {
@@ -3521,14 +5863,13 @@ main(int argc, char *argv[])
 		fputs("warning: no locale support\n", stderr);
 	if (!(dpy = XOpenDisplay(NULL)))
 		die("dwm: cannot open display");
+	xcon = XGetXCBConnection(dpy);
 	checkotherwm();
 	setup();
-#ifdef __OpenBSD__
-	if (pledge("stdio rpath proc exec", NULL) == -1)
-		die("pledge");
-#endif /* __OpenBSD__ */
 	scan();
 	run();
+	if (return_code == EXIT_RELOAD)
+		savestate();
 	cleanup();
 	XCloseDisplay(dpy);
 
@@ -0,0 +1,99 @@
+/* cc -O2 focusbench.c -o focusbench -lX11
+ *
+ * Moves the focus of a running dwm back and forth between two windows by
+ * warping the pointer, and reports how long each change took to show up
+ * in _NET_ACTIVE_WINDOW. The bars drawn for them are counted by dwm
+ * itself: compare the "focus marked n bars of m" line it prints when it
+ * exits with the number of changes printed here. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <X11/Xatom.h>
+#include <X11/Xlib.h>
+
+#define CHANGES 1000
+
+static Display *dpy;
+static Window root;
+static Atom active;
+
+static Window
+activewin(void)
+{
+	Atom type;
+	int format;
+	unsigned long n, extra;
+	unsigned char *p = NULL;
+	Window r = None;
+
+	if (XGetWindowProperty(dpy, root, active, 0, 1, False, XA_WINDOW,
+		&type, &format, &n, &extra, &p) == Success && n == 1)
+		r = *(Window *)p;
+	if (p)
+		XFree(p);
+	return r;
+}
+
+/* waits for _NET_ACTIVE_WINDOW to become w, 0 after 1000 other
+ * property changes on the root window */
+static int
+waitactive(Window w)
+{
+	XEvent ev;
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		if (activewin() == w)
+			return 1;
+		XNextEvent(dpy, &ev);
+	}
+	return 0;
+}
+
+static uint64_t
+nsnow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int
+main(void)
+{
+	Window w[2];
+	uint64_t t0, t;
+	int i;
+
+	if (!(dpy = XOpenDisplay(NULL))) {
+		fputs("focusbench: cannot open display\n", stderr);
+		return 1;
+	}
+	root = DefaultRootWindow(dpy);
+	active = XInternAtom(dpy, "_NET_ACTIVE_WINDOW", False);
+	XSelectInput(dpy, root, PropertyChangeMask);
+	for (i = 0; i < 2; i++) {
+		w[i] = XCreateSimpleWindow(dpy, root, 0, 0, 200, 200, 0, 0, 0);
+		XMapWindow(dpy, w[i]);
+	}
+	XSync(dpy, False);
+
+	t0 = nsnow();
+	for (i = 0; i < CHANGES; i++) {
+		XWarpPointer(dpy, None, w[i & 1], 0, 0, 0, 0, 10, 10);
+		if (!waitactive(w[i & 1])) {
+			fprintf(stderr, "focusbench: change %d not seen, "
+				"are both windows visible?\n", i);
+			return 1;
+		}
+	}
+	t = nsnow() - t0;
+	printf("focusbench: %d focus changes, %lu us each\n", CHANGES,
+		(unsigned long)(t / CHANGES / 1000));
+	XCloseDisplay(dpy);
+	return 0;
+}
@@ -0,0 +1,89 @@
+/* cc -O2 glyphbench.c drw.o util.o -o glyphbench -lX11 -lXft -lfontconfig
+ *
+ * Times drw_fontset_getwidth() on bar-like text with the glyph cache of
+ * the font set warm, and with it emptied before each call, which costs
+ * what every call cost before the cache: an XftCharExists() and an
+ * extents query per character. Needs an X server for Xft; the font can be
+ * given as argument. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <X11/Xlib.h>
+#include <X11/Xft/Xft.h>
+
+#include "drw.h"
+#include "util.h"
+
+#define ROUNDS 20000
+
+static const char *texts[] = {
+	"1 2 3 4 5 6 7 8 9",
+	"[]= ~/src/dwm - vim dwm.c",
+	"Mozilla Firefox - Private Browsing",
+	"vol 42% | bat 87% | 2026-10-16 17:50",
+	"Überweisung – Kontoauszüge — ‹€ 1.234,56›",
+};
+
+static void
+emptycache(Fnt *set)
+{
+	memset(set->ascii, 0, sizeof set->ascii);
+	free(set->glyphs);
+	set->glyphs = NULL;
+}
+
+static uint64_t
+nsnow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *fonts[] = { argc > 1 ? argv[1] : "monospace:size=10" };
+	Display *dpy;
+	Drw *drw;
+	Fnt *set;
+	uint64_t t0, warm, cold;
+	unsigned long sum = 0;
+	size_t i, j;
+
+	if (!(dpy = XOpenDisplay(NULL)))
+		die("glyphbench: cannot open display");
+	drw = drw_create(dpy, DefaultScreen(dpy), DefaultRootWindow(dpy));
+	if (!(set = drw_fontset_create(drw, fonts, LENGTH(fonts))))
+		die("glyphbench: no fonts could be loaded");
+
+	printf("%-42s %10s %10s\n", "text", "cold ns", "warm ns");
+	for (i = 0; i < LENGTH(texts); i++) {
+		t0 = nsnow();
+		for (j = 0; j < ROUNDS; j++) {
+			emptycache(set);
+			sum += drw_fontset_getwidth(drw, texts[i]);
+		}
+		cold = nsnow() - t0;
+		t0 = nsnow();
+		for (j = 0; j < ROUNDS; j++)
+			sum += drw_fontset_getwidth(drw, texts[i]);
+		warm = nsnow() - t0;
+		printf("%-42.42s %10lu %10lu\n", texts[i],
+			(unsigned long)(cold / ROUNDS), (unsigned long)(warm / ROUNDS));
+	}
+	/* keeps the calls from being optimized away */
+	if (!sum)
+		return 1;
+
+	drw_fontset_free(set);
+	drw_free(drw);
+	XCloseDisplay(dpy);
+	return 0;
+}
@@ -0,0 +1,108 @@
+/* See LICENSE file for copyright and license details. */
+
+/* dwm listens on a SOCK_SEQPACKET socket named by IPC_SOCKET in
+ * config.h, in $XDG_RUNTIME_DIR or /tmp. A message is an array of up
+ * to IPC_BATCH_MAX IpcCmd, run in order; arranging and redrawing is
+ * done once after the whole batch. Every message is answered with one
+ * IpcReply. Values are in host byte order. */
+
+#include <stdint.h>
+
+#define IPC_BATCH_MAX 64
+
+enum { IpcOk, IpcBadSize, IpcBadOp }; /* IpcReply status */
+
+typedef struct {
+	uint32_t op;          /* index into ipccmds[] of config.h */
+	uint32_t pad;
+	union {
+		int32_t i;
+		float f;
+		uint64_t t;       /* tag mask */
+		struct {
+			int16_t s1, s2;
+		} s;
+	} arg;                /* as the argument type of the op needs */
+} IpcCmd;
+
+typedef struct {
+	uint32_t status;      /* IpcOk, ... */
+	uint32_t done;        /* commands run */
+} IpcReply;
+
+/* An IpcCmd with op IPC_SUBSCRIBE and arg.t set to a mask of
+ * 1 << IpcEv... subscribes the connection to those events, 0 ends the
+ * subscription. Events then arrive as IpcEvent messages, told apart
+ * from IpcReply by their size. dwm never waits for a subscriber: what
+ * does not fit its queue is dropped and counted in the next event. */
+
+#define IPC_SUBSCRIBE 0xffffffffu
+
+enum { IpcEvFocus, IpcEvView, IpcEvManage, IpcEvUnmanage,
+       IpcEvTitle, IpcEvUrgent }; /* IpcEvent types */
+
+typedef struct {
+	uint32_t type;        /* IpcEvFocus, ... */
+	uint32_t dropped;     /* events lost right before this one */
+	uint32_t win;         /* client, 0 for IpcEvView or without focus */
+	int32_t mon;          /* monitor number */
+	int32_t cls;          /* class index as in ShmState or -1 */
+	uint32_t pad;
+	uint64_t arg;         /* view: tag mask (0 with a class), urgent: 0/1 */
+} IpcEvent;
+
+/* dwm also publishes its state in a file named by SHM_STATE in
+ * config.h, next to the socket, for readers to mmap(). The state is
+ * rewritten once per event batch that changed anything. It is guarded
+ * by a sequence lock, so readers copy what they need like this:
+ *
+ *	do {
+ *		while ((seq = __atomic_load_n(&st->seq, __ATOMIC_ACQUIRE)) & 1);
+ *		copy = *st;
+ *		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+ *	} while (__atomic_load_n(&st->seq, __ATOMIC_RELAXED) != seq);
+ *
+ * Lists longer than the arrays are cut, the counts say how many
+ * entries are valid. */
+
+#define SHM_MONS_MAX    8
+#define SHM_CLASSES_MAX 64
+#define SHM_CLIENTS_MAX 256
+
+enum { ShmFloating = 1, ShmUrgent = 2, ShmFullscreen = 4 }; /* ShmClient flags */
+
+typedef struct {
+	int32_t num;
+	int32_t x, y, w, h;       /* window area */
+	uint64_t curtags;         /* 0 while a class is viewed */
+	uint64_t prevtags;
+	int32_t curcls, prevcls;  /* index into classes or -1 */
+	uint32_t sel;             /* selected window or 0 */
+	int32_t nmaster;
+	float mfact;
+	char ltsymbol[16];
+} ShmMon;
+
+typedef struct {
+	char name[256];
+	uint32_t nclients;
+} ShmClass;
+
+typedef struct {
+	uint32_t win;
+	int32_t mon, cls;         /* index into mons and classes */
+	uint64_t tags;
+	int32_t x, y, w, h;
+	uint32_t flags;           /* ShmFloating, ... */
+	char name[256];
+} ShmClient;
+
+typedef struct {
+	uint32_t seq;             /* odd while dwm writes */
+	uint32_t size;            /* sizeof(ShmState) */
+	uint32_t nmons, nclasses, nclients;
+	int32_t selmon;           /* index into mons */
+	ShmMon mons[SHM_MONS_MAX];
+	ShmClass classes[SHM_CLASSES_MAX];
+	ShmClient clients[SHM_CLIENTS_MAX]; /* in client list order per monitor */
+} ShmState;
@@ -0,0 +1,79 @@
+/* cc -O2 ipcbench.c -o ipcbench
+ *
+ * Times round trips on the dwm socket given as argument: a message is
+ * sent and its IpcReply awaited, with one and with IPC_BATCH_MAX commands
+ * per message. The commands are IPC_SUBSCRIBE with an empty mask, which
+ * goes through the same dispatch as the other ops but changes nothing,
+ * so it can be run against the dwm in use. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ipc.h"
+
+#define ROUNDS 10000
+
+static uint64_t
+nsnow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int
+bench(int fd, int batch)
+{
+	IpcCmd cmd[IPC_BATCH_MAX];
+	IpcReply rep;
+	uint64_t t0, t, min = UINT64_MAX, sum = 0;
+	int i;
+
+	for (i = 0; i < batch; i++)
+		cmd[i] = (IpcCmd){ .op = IPC_SUBSCRIBE, .arg.t = 0 };
+	for (i = 0; i < ROUNDS; i++) {
+		t0 = nsnow();
+		if (send(fd, cmd, batch * sizeof cmd[0], 0) != (ssize_t)(batch * sizeof cmd[0])
+		|| recv(fd, &rep, sizeof rep, 0) != sizeof rep
+		|| rep.status != IpcOk || rep.done != (uint32_t)batch) {
+			fputs("ipcbench: bad reply\n", stderr);
+			return -1;
+		}
+		t = nsnow() - t0;
+		sum += t;
+		if (t < min)
+			min = t;
+	}
+	printf("ipcbench: %2d commands per message: mean %lu ns, min %lu ns\n",
+		batch, (unsigned long)(sum / ROUNDS), (unsigned long)min);
+	return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	int fd;
+
+	if (argc != 2 || strlen(argv[1]) >= sizeof addr.sun_path) {
+		fputs("usage: ipcbench socket\n", stderr);
+		return 1;
+	}
+	strcpy(addr.sun_path, argv[1]);
+	if ((fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) < 0
+	|| connect(fd, (struct sockaddr *)&addr, sizeof addr) < 0) {
+		perror("ipcbench: connect");
+		return 1;
+	}
+	if (bench(fd, 1) < 0 || bench(fd, IPC_BATCH_MAX) < 0)
+		return 1;
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,72 @@
+/* cc ipctest.c -o ipctest
+ *
+ * Subscribes to view events on the dwm socket given as argument, changes
+ * the view with op 0 (tag_view in config.def.h) and waits for the event.
+ * Exits 0 once it arrived, 1 otherwise. Run by check.sh. */
+
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "ipc.h"
+
+static int
+request(int fd, uint32_t op, uint64_t t)
+{
+	IpcCmd cmd = { .op = op, .arg.t = t };
+
+	return send(fd, &cmd, sizeof cmd, 0) == sizeof cmd ? 0 : -1;
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct pollfd pfd;
+	char buf[64];
+	IpcEvent ev;
+	IpcReply rep;
+	ssize_t n;
+	int fd;
+
+	if (argc != 2 || strlen(argv[1]) >= sizeof addr.sun_path) {
+		fputs("usage: ipctest socket\n", stderr);
+		return 1;
+	}
+	strcpy(addr.sun_path, argv[1]);
+	if ((fd = socket(AF_UNIX, SOCK_SEQPACKET, 0)) < 0
+	|| connect(fd, (struct sockaddr *)&addr, sizeof addr) < 0) {
+		perror("ipctest: connect");
+		return 1;
+	}
+
+	if (request(fd, IPC_SUBSCRIBE, 1ULL << IpcEvView) < 0
+	|| recv(fd, &rep, sizeof rep, 0) != sizeof rep || rep.status != IpcOk) {
+		fputs("ipctest: subscribe refused\n", stderr);
+		return 1;
+	}
+	/* one of the two is a change whatever the view was */
+	if (request(fd, 0, 1 << 1) < 0 || request(fd, 0, 1 << 2) < 0) {
+		perror("ipctest: send");
+		return 1;
+	}
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	while (poll(&pfd, 1, 2000) > 0) {
+		if ((n = recv(fd, buf, sizeof buf, 0)) <= 0)
+			break;
+		if (n != sizeof ev)
+			continue; /* an IpcReply */
+		memcpy(&ev, buf, sizeof ev);
+		if (ev.type == IpcEvView) {
+			printf("ipctest: view event, tags %#llx\n", (unsigned long long)ev.arg);
+			return 0;
+		}
+	}
+	fputs("ipctest: no view event\n", stderr);
+	return 1;
+}
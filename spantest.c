@@ -0,0 +1,67 @@
+/* cc spantest.c drw.o util.o -o spantest (with the flags of dwm)
+ *
+ * Builds dwm.c into the test to check the hit-test map of the bar: spans
+ * past BAR_SPANS_MAX must not replace the ones before them, and the rest
+ * of the bar becomes one gap. Needs no X server. Run by "make check". */
+
+#define main dwmmain
+#include "dwm.c"
+#undef main
+
+static int fail;
+
+static void
+expect(Monitor *m, int x, uint type, tag_t t)
+{
+	BarSpan *sp = _bar_span_at(m, x);
+	uint got = sp ? sp->type : SpanLast;
+
+	if (got != type || (sp && type == SpanTag && sp->t != t)) {
+		fprintf(stderr, "spantest: x %d: span type %u tag %#llx, expected %u tag %#llx\n",
+			x, got, sp ? (unsigned long long)sp->t : 0,
+			type, (unsigned long long)t);
+		fail = 1;
+	}
+}
+
+int
+main(void)
+{
+	Monitor m = { 0 };
+	int i, n = BAR_SPANS_MAX + 8;
+
+	m.spans = ecalloc(BAR_SPANS_MAX, sizeof(BarSpan));
+
+	/* a tag every 10 pixels, more than fit */
+	for (i = 0; i < n; i++)
+		_bar_span(&m, SpanTag, (i + 1) * 10)->t = (tag_t)1 << (i % 64);
+	if (m.nspans != BAR_SPANS_MAX) {
+		fprintf(stderr, "spantest: %d spans recorded, room for %d\n",
+			m.nspans, (int)BAR_SPANS_MAX);
+		fail = 1;
+	}
+	/* each recorded tag keeps its place */
+	for (i = 0; i < BAR_SPANS_MAX - 1; i++) {
+		expect(&m, i * 10, SpanTag, (tag_t)1 << (i % 64));
+		expect(&m, i * 10 + 9, SpanTag, (tag_t)1 << (i % 64));
+	}
+	/* what did not fit is one gap up to the last span, then nothing */
+	expect(&m, (BAR_SPANS_MAX - 1) * 10, SpanGap, 0);
+	expect(&m, n * 10 - 1, SpanGap, 0);
+	expect(&m, n * 10, SpanLast, 0);
+
+	/* a gap between two spans belongs to neither */
+	m.nspans = 0;
+	_bar_span(&m, SpanTag, 10)->t = 1;
+	_bar_span(&m, SpanGap, 12);
+	_bar_span(&m, SpanTag, 22)->t = 2;
+	expect(&m, 9, SpanTag, 1);
+	expect(&m, 10, SpanGap, 0);
+	expect(&m, 11, SpanGap, 0);
+	expect(&m, 12, SpanTag, 2);
+
+	free(m.spans);
+	if (!fail)
+		printf("spantest: %d spans for room of %d, ok\n", n, (int)BAR_SPANS_MAX);
+	return fail;
+}
@@ -0,0 +1,161 @@
+/* cc -O2 wintabbench.c -o wintabbench
+ *
+ * Times window lookups the way wintoclient() did them, walking the
+ * client lists, against the hash table dwm uses now (the _wintab_
+ * functions, copied from dwm.c). Half of the lookups miss, like events
+ * for windows dwm does not manage. Needs no X server. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define LOOKUPS (1 << 22)
+
+typedef unsigned long Window;
+typedef struct Client Client;
+struct Client {
+	Window win;
+	Client *next;
+};
+
+typedef struct {
+	Window win;
+	Client *c;
+	void *m;
+} WinRef;
+
+static WinRef *wintab;
+static size_t wintabsz, wintabcnt;
+static Client *clients;
+
+#define WINTAB_SLOT(W)          ((size_t)((W) * 2654435761UL) & (wintabsz - 1))
+
+static WinRef *
+_wintab_find(Window w)
+{
+	size_t i;
+
+	if (!wintabsz)
+		return NULL;
+	for (i = WINTAB_SLOT(w); wintab[i].win; i = (i + 1) & (wintabsz - 1))
+		if (wintab[i].win == w)
+			return &wintab[i];
+	return NULL;
+}
+
+static WinRef *
+_wintab_slot_free(Window w)
+{
+	size_t i;
+
+	for (i = WINTAB_SLOT(w); wintab[i].win; i = (i + 1) & (wintabsz - 1));
+	return &wintab[i];
+}
+
+static void
+_wintab_put(Window w, Client *c)
+{
+	WinRef *old = wintab, *r;
+	size_t i, oldsz = wintabsz;
+
+	if ((wintabcnt + 1) * 4 > wintabsz * 3) {
+		wintabsz = wintabsz ? wintabsz * 2 : 64;
+		wintab = calloc(wintabsz, sizeof(WinRef));
+		for (i = 0; i < oldsz; i++)
+			if (old[i].win)
+				*_wintab_slot_free(old[i].win) = old[i];
+		free(old);
+	}
+	r = _wintab_slot_free(w);
+	r->win = w;
+	r->c = c;
+	wintabcnt++;
+}
+
+static Client *
+listfind(Window w)
+{
+	Client *c;
+
+	for (c = clients; c; c = c->next)
+		if (c->win == w)
+			return c;
+	return NULL;
+}
+
+static Client *
+tabfind(Window w)
+{
+	WinRef *r = _wintab_find(w);
+
+	return r ? r->c : NULL;
+}
+
+static uint64_t
+nsnow(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static double
+bench(Client *(*find)(Window), const Window *keys, size_t *hits)
+{
+	uint64_t t0 = nsnow();
+	size_t i, n = 0;
+
+	for (i = 0; i < LOOKUPS; i++)
+		n += find(keys[i]) != NULL;
+	*hits = n;
+	return (double)(nsnow() - t0) / LOOKUPS;
+}
+
+int
+main(void)
+{
+	static const int sizes[] = { 8, 32, 128, 512 };
+	Window *keys = malloc(LOOKUPS * sizeof(Window));
+	size_t i, j, n, hl, ht;
+	Client *c;
+	double tl, tt;
+
+	printf("%8s %12s %12s\n", "clients", "list ns", "table ns");
+	for (i = 0; i < sizeof sizes / sizeof sizes[0]; i++) {
+		n = sizes[i];
+		clients = NULL;
+		free(wintab);
+		wintab = NULL;
+		wintabsz = wintabcnt = 0;
+		/* resource ids of one X client: a base and a counter */
+		for (j = 0; j < n; j++) {
+			c = calloc(1, sizeof(Client));
+			c->win = 0x1e00000 + 3 * j;
+			c->next = clients;
+			clients = c;
+			_wintab_put(c->win, c);
+		}
+		srand(1);
+		for (j = 0; j < LOOKUPS; j++)
+			keys[j] = 0x1e00000 + 3 * (rand() % n) + (j & 1);
+		tl = bench(listfind, keys, &hl);
+		tt = bench(tabfind, keys, &ht);
+		if (hl != ht) {
+			fputs("wintabbench: lookups disagree\n", stderr);
+			return 1;
+		}
+		printf("%8zu %12.1f %12.1f\n", n, tl, tt);
+		while ((c = clients)) {
+			clients = c->next;
+			free(c);
+		}
+	}
+	free(keys);
+	free(wintab);
+	return 0;
+}